@@ -0,0 +1,47 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+	#include <stddef.h>
+
+	/*
+	 * Pipeline stages.
+	 */
+	#define AFFINITY_READER 0 /* Reader thread.  */
+	#define AFFINITY_WORKER 1 /* Codec thread.   */
+	#define AFFINITY_WRITER 2 /* Writer thread.  */
+	#define AFFINITY_STAGES 3 /* Number of them. */
+
+	/*
+	 * Opaque pointer to a thread placement.
+	 */
+	typedef struct affinity * affinity_t;
+
+	/* Forward definitions. */
+	extern void affinity_apply(affinity_t, int);
+	extern void affinity_bind(void *, size_t, int);
+	extern affinity_t affinity_create(const char *);
+	extern void affinity_destroy(affinity_t);
+	extern int affinity_ncpus(void);
+	extern int affinity_node(affinity_t);
+	extern void affinity_pool(affinity_t, int);
+
+#endif /* AFFINITY_H_ */
@@ -0,0 +1,37 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+	#include <stddef.h>
+
+	/*
+	 * Opaque pointer to a memory arena.
+	 */
+	typedef struct arena * arena_t;
+
+	/* Forward definitions. */
+	extern void *arena_alloc(arena_t, size_t);
+	extern arena_t arena_create(size_t, int);
+	extern void arena_destroy(arena_t);
+	extern void arena_reset(arena_t);
+	extern size_t arena_used(arena_t);
+
+#endif /* ARENA_H_ */
@@ -20,6 +20,8 @@
 #ifndef BUFFER_H_
 #define BUFFER_H_
 
+	#include <arena.h>
+
 	/*
 	 * Opaque pointer to a circular buffer.
 	 */
@@ -27,11 +29,12 @@
 
 	/* Forward definitions. */
 	extern void buffer_destroy(buffer_t);
+	extern size_t buffer_footprint(unsigned);
     /**
      * block if buffer is empty
      * */
 	extern unsigned buffer_get(buffer_t);
-	extern buffer_t buffer_create(unsigned);
+	extern buffer_t buffer_create(unsigned, arena_t);
     /**
      * block if buffer is full
      * */
@@ -0,0 +1,29 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CRC_H_
+#define CRC_H_
+
+	#include <stddef.h>
+
+	/* Forward definitions. */
+	extern unsigned crc32c(unsigned, const void *, size_t);
+	extern unsigned crc32c_combine(unsigned, unsigned, size_t);
+
+#endif /* CRC_H_ */
@@ -0,0 +1,92 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEDUP_H_
+#define DEDUP_H_
+
+	#include <arena.h>
+	#include <stddef.h>
+	#include <stdint.h>
+
+/*============================================================================*
+ *                            Private Interface                               *
+ *============================================================================*/
+
+	/*
+	 * Deduplication parameters. Chunks are cut where the top bits of a
+	 * rolling hash are zero, which happens once every 8 KiB on average.
+	 */
+	#define DEDUP_WINDOW (1 << 23)                  /* History size (bytes).      */
+	#define DEDUP_MIN    2048                      /* Minimum chunk size.        */
+	#define DEDUP_MAX    32768                     /* Maximum chunk size.        */
+	#define DEDUP_MASK   ((uint64_t) 0x1fff << 51) /* Chunk cut mask.            */
+	#define DEDUP_SLOTS  (1 << 13)                 /* Fingerprint table entries. */
+
+	/*
+	 * Recent data, kept to resolve chunk references.
+	 */
+	struct history
+	{
+		unsigned char *buf; /* Recent bytes (circular). */
+		size_t size;        /* Capacity (power of 2).   */
+		uint64_t len;       /* Bytes seen so far.       */
+	};
+
+	/*
+	 * Fingerprint of a chunk.
+	 */
+	struct fingerprint
+	{
+		uint64_t offset; /* Input offset.     */
+		unsigned len;    /* Length.           */
+		unsigned crc;    /* CRC-32C of data.  */
+	};
+
+	/*
+	 * Content-defined chunker.
+	 *
+	 * Input is cut into chunks with a gear rolling hash, so that cut
+	 * points move along with inserted or deleted data. Chunks seen in
+	 * the recent input are replaced by references to their last copy,
+	 * after a byte-wise comparison with it.
+	 */
+	struct dedup
+	{
+		struct history *hist;      /* Recent input.        */
+		struct fingerprint *table; /* Chunk fingerprints.  */
+		unsigned char *chunk;      /* Pending chunk.       */
+		size_t n;                  /* Pending chunk size.  */
+		uint64_t hash;             /* Rolling hash.        */
+	};
+
+/*============================================================================*
+ *                             Public Interface                               *
+ *============================================================================*/
+
+	/* Forward definitions. */
+	extern uint64_t dedup_chunk(struct dedup *, uint64_t);
+	extern struct dedup *dedup_create(arena_t);
+	extern size_t dedup_footprint(void);
+	extern size_t dedup_scan(struct dedup *, const unsigned char *, size_t, int *);
+	extern struct history *history_create(size_t, arena_t);
+	extern void history_deref(const struct history *, uint64_t, size_t, unsigned char *);
+	extern size_t history_footprint(size_t);
+	extern void history_put(struct history *, const unsigned char *, size_t);
+
+#endif /* DEDUP_H_ */
@@ -20,6 +20,8 @@
 #ifndef DICTIONARY_H_
 #define DICTIONARY_H_
 
+	#include <arena.h>
+
 /*============================================================================*
  *                            Private Interface                               *
  *============================================================================*/
@@ -49,6 +51,7 @@
 		int max_entries;       /* Maximum number of entries. */
 		int nentries;          /* Number of entries.         */
 		struct entry *entries; /* Entries.                   */
+		arena_t arena;         /* Backing arena (or NULL).   */
 	};
 	
 	/*
@@ -62,9 +65,10 @@
  
 	/* Forward definitions. */
 	extern int dictionary_add(dictionary_t, int, char, code_t);
-	extern dictionary_t dictionary_create(int);
+	extern dictionary_t dictionary_create(int, arena_t);
 	extern void dictionary_destroy(dictionary_t);
 	extern int dictionary_find(dictionary_t, int, char);
+	extern size_t dictionary_footprint(int);
 	extern void dictionary_reset(struct dictionary *);
 
 #endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENTROPY_H_
+#define ENTROPY_H_
+
+	#include <arena.h>
+	#include <buffer.h>
+	#include <stddef.h>
+	#include <stdint.h>
+	#include <stdio.h>
+	#include <stream.h>
+
+/*============================================================================*
+ *                            Private Interface                               *
+ *============================================================================*/
+
+	/*
+	 * Entropy coding parameters. Codes are coded in blocks, each one with
+	 * its own table of canonical Huffman codes.
+	 */
+	#define ENTROPY_SYMBOLS (1 << 15) /* Codes per block.              */
+	#define ENTROPY_RAW     (1 << 15) /* Raw bytes per block.          */
+	#define ENTROPY_MINSYMS 64        /* Smallest block worth a table. */
+	#define ENTROPY_MAXLEN  12        /* Longest symbol code (bits).   */
+	#define ENTROPY_BUCKETS 48        /* Buckets of code distances.    */
+
+	/*
+	 * Entropy coding alphabet: literals, control codes and two sets
+	 * of buckets for regular codes.
+	 */
+	#define ENTROPY_SIZE (RADIX + NCONTROL + 2*ENTROPY_BUCKETS)
+
+	/*
+	 * Symbol model. Regular codes are coded by their distance below the
+	 * highest code seen since the dictionary was last reset, since codes
+	 * defined lately are the likely ones, and codes above that by their
+	 * distance past it. Small distances have a bucket of their own, larger
+	 * ones share one with others of the same magnitude and need extra bits.
+	 */
+	struct model
+	{
+		unsigned max; /* Highest code seen. */
+	};
+
+	/*
+	 * Packer. Holds codes back until a block is done, and then writes the
+	 * block as whichever kind is shorter. Like the bit writer, it packs
+	 * into a caller-drained byte array, which must have room for a block.
+	 */
+	struct packer
+	{
+		unsigned short *codes; /* Codes held back.         */
+		size_t ncodes;         /* Number of codes.         */
+		unsigned char *raw;    /* Raw bytes held back.     */
+		size_t nraw;           /* Number of raw bytes.     */
+		unsigned pending;      /* Raw bytes still to come. */
+		unsigned buf;          /* Working bits.            */
+		unsigned n;            /* Number of bits.          */
+		unsigned char *out;    /* Output bytes.            */
+		size_t len;            /* Output length.           */
+	};
+
+	/*
+	 * Unpacker. Reads the codes of an entropy coded stream from a file,
+	 * a buffer of bytes or a byte array. Huffman blocks may be read a couple of
+	 * bytes ahead, but never past a stream checksum, since it comes in
+	 * a fixed block.
+	 */
+	struct unpacker
+	{
+		FILE *in;                                  /* Input file.            */
+		buffer_t src;                              /* Input buffer.          */
+		const unsigned char *mem;                  /* Input bytes.           */
+		size_t avail;                              /* Input bytes left.      */
+		uint64_t buf;                              /* Working bits.          */
+		unsigned n;                                /* Number of bits.        */
+		unsigned over;                             /* Bits past end of file. */
+		int kind;                                  /* Block kind.            */
+		unsigned left;                             /* Codes left in block.   */
+		struct model m;                            /* Symbol model.          */
+		unsigned word;                             /* Checksum or distance.  */
+		unsigned short table[1 << ENTROPY_MAXLEN]; /* Symbols by next bits.  */
+	};
+
+/*============================================================================*
+ *                             Public Interface                               *
+ *============================================================================*/
+
+	/* Forward definitions. */
+	extern void packer_block(struct packer *);
+	extern void packer_end(struct packer *);
+	extern size_t packer_footprint(void);
+	extern void packer_init(struct packer *, arena_t, unsigned char *);
+	extern void packer_put(struct packer *, unsigned);
+	extern size_t packer_room(void);
+	extern unsigned unpacker_byte(struct unpacker *);
+	extern unsigned unpacker_get(struct unpacker *);
+	extern void unpacker_init(struct unpacker *, FILE *, buffer_t);
+	extern void unpacker_memory(struct unpacker *, const unsigned char *, size_t);
+
+#endif /* ENTROPY_H_ */
@@ -20,9 +20,70 @@
 #ifndef GLOBAL_H_
 #define GLOBAL_H_
 	
+	#include <pool.h>
+	#include <shdict.h>
+	#include <stddef.h>
+	#include <stdint.h>
 	#include <stdio.h>
 
+	/*
+	 * Codec options.
+	 */
+	struct lzw_options
+	{
+		shdict_t dict;        /* Shared dictionary (may be NULL).     */
+		int sync;             /* Allow sync flushes?                  */
+		unsigned flush_bytes; /* Sync flush every n input bytes.      */
+		unsigned flush_idle;  /* Sync flush after n ms without input. */
+		size_t memory;        /* Session memory budget (0: default).  */
+		const char *affinity; /* Thread placement (NULL: automatic).  */
+		pool_t pool;          /* Thread pool (may be NULL).           */
+		size_t block_size;    /* Pool block size (0: default).        */
+		int verify;           /* Verify while compressing?            */
+		int store;            /* Store incompressible data raw?       */
+		int crc;              /* Add checksums?                       */
+		int append;           /* Append to the output file?           */
+		const char *state;    /* Dictionary state file (may be NULL). */
+		size_t checkpoint;    /* Checkpoint every n input bytes.      */
+		const char *ckpt;     /* Checkpoint file (may be NULL).       */
+		int resume;           /* Resume from the last checkpoint?     */
+		int dedup;            /* Deduplicate repeated chunks?         */
+		int entropy;          /* Entropy code the codes?              */
+	};
+
+	/*
+	 * Compressibility estimate. Bounds are 95% confidence intervals,
+	 * which shrink to the estimate when the whole input is sampled.
+	 */
+	struct lzw_estimate
+	{
+		double ratio;    /* Compressed size over input size. */
+		double ratio_lo; /* Lower bound on ratio.            */
+		double ratio_hi; /* Upper bound on ratio.            */
+		double speed;    /* Throughput (bytes/s).            */
+		double speed_lo; /* Lower bound on throughput.       */
+		double speed_hi; /* Upper bound on throughput.       */
+		size_t sampled;  /* Bytes sampled.                   */
+		size_t size;     /* Input size (0: unknown).         */
+		unsigned jobs;   /* Pool workers (0: no pool).       */
+	};
+
+	/*
+	 * Opaque pointer to a codec session.
+	 */
+	typedef struct lzw_session * lzw_session_t;
+
 	/* Forward definitions */
-	extern void lzw(FILE *, FILE *, int);
+	extern void lzw(FILE *, FILE *, int, const struct lzw_options *);
+	extern lzw_session_t lzw_session_create(const struct lzw_options *);
+	extern void lzw_session_destroy(lzw_session_t);
+	extern void lzw_session_flush(lzw_session_t);
+	extern void lzw_session_run(lzw_session_t, FILE *, FILE *, int);
+	extern void lzw_estimate(FILE *, const struct lzw_options *, struct lzw_estimate *);
+	extern void lzw_session_estimate(lzw_session_t, FILE *, struct lzw_estimate *);
+	extern uint64_t lzw_search(FILE *, const unsigned char *, size_t,
+		const struct lzw_options *, void (*)(void *, uint64_t), void *);
+	extern uint64_t lzw_session_search(lzw_session_t, FILE *,
+		const unsigned char *, size_t, void (*)(void *, uint64_t), void *);
 
 #endif /* GLOBAL_H_ */
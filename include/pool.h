@@ -0,0 +1,47 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POOL_H_
+#define POOL_H_
+
+	#include <arena.h>
+	#include <stddef.h>
+
+	/*
+	 * Opaque pointer to a thread pool.
+	 */
+	typedef struct pool * pool_t;
+
+	/*
+	 * Opaque pointer to a batch of tasks that
+	 * complete in submission order.
+	 */
+	typedef struct pool_batch * pool_batch_t;
+
+	/* Forward definitions. */
+	extern pool_t pool_create(int, const char *);
+	extern void pool_destroy(pool_t);
+	extern int pool_workers(pool_t);
+	extern pool_batch_t pool_batch_create(pool_t, unsigned, void (*)(void *), arena_t);
+	extern void pool_batch_destroy(pool_batch_t);
+	extern size_t pool_batch_footprint(unsigned);
+	extern void pool_batch_submit(pool_batch_t, void (*)(void *), void *);
+	extern void pool_batch_wait(pool_batch_t, unsigned);
+
+#endif /* POOL_H_ */
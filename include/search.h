@@ -0,0 +1,42 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+	#include <dedup.h>
+	#include <dictionary.h>
+	#include <shdict.h>
+	#include <stddef.h>
+	#include <stdint.h>
+
+	/*
+	 * Opaque pointer to a compressed-domain searcher.
+	 */
+	typedef struct searcher * searcher_t;
+
+	/* Forward definitions. */
+	extern uint64_t searcher_count(searcher_t);
+	extern searcher_t searcher_create(const unsigned char *, size_t, shdict_t,
+		code_t, struct history *, void (*)(void *, uint64_t), void *);
+	extern void searcher_destroy(searcher_t);
+	extern void searcher_put(searcher_t, unsigned);
+	extern void searcher_raw(searcher_t, const unsigned char *, size_t);
+
+#endif /* SEARCH_H_ */
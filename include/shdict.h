@@ -0,0 +1,68 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHDICT_H_
+#define SHDICT_H_
+
+	#include <stdio.h>
+
+/*============================================================================*
+ *                            Private Interface                               *
+ *============================================================================*/
+
+	/*
+	 * Shared dictionary entry.
+	 *
+	 * Parents below the radix are literal bytes, parents above it
+	 * refer to a previous entry (parent - radix) of the same table.
+	 */
+	struct shdict_entry
+	{
+		unsigned parent;  /* Parent string. */
+		unsigned char ch; /* Last character. */
+	};
+
+	/*
+	 * Shared dictionary.
+	 */
+	struct shdict
+	{
+		unsigned id;                  /* Dictionary ID.     */
+		int nentries;                 /* Number of entries. */
+		struct shdict_entry *entries; /* Entries.           */
+	};
+
+	/*
+	 * Opaque pointer to a shared dictionary.
+	 */
+	typedef struct shdict * shdict_t;
+
+/*============================================================================*
+ *                             Public Interface                               *
+ *============================================================================*/
+
+	/* Forward definitions. */
+	extern void shdict_destroy(shdict_t);
+	extern shdict_t shdict_load(const char *);
+	extern shdict_t shdict_read(FILE *);
+	extern void shdict_save(shdict_t, const char *);
+	extern shdict_t shdict_train(FILE *, int, int);
+	extern void shdict_write(shdict_t, FILE *);
+
+#endif /* SHDICT_H_ */
@@ -0,0 +1,69 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+	/*
+	 * Parameters.
+	 */
+	#define RADIX 256 /* Radix of input data. */
+	#define WIDTH  12 /* Width of code word.  */
+
+	/*
+	 * Control codes. Headerless streams only have the reset code, streams
+	 * with a header reserve NCONTROL codes right after the radix.
+	 */
+	#define NCONTROL   16          /* Reserved control codes. */
+	#define CODE_RESET (RADIX + 0) /* Dictionary reset.       */
+	#define CODE_FLUSH (RADIX + 1) /* Sync flush.             */
+	#define CODE_STORE (RADIX + 2) /* Stored segment.         */
+	#define CODE_CRC   (RADIX + 3) /* Segment checksum.       */
+	#define CODE_END   (RADIX + 4) /* Stream checksum.        */
+	#define CODE_REF   (RADIX + 5) /* Chunk reference.        */
+
+	/*
+	 * Pipeline tokens, passed along with codes and bytes in the buffers.
+	 */
+	#define TOKEN_FLUSH (1 << 16) /* Sync flush.                   */
+	#define TOKEN_NONE  (1 << 17) /* No code yet.                  */
+	#define TOKEN_STORE (1 << 18) /* Stored segment (plus length). */
+	#define TOKEN_CRC   (1 << 19) /* Segment checksum.             */
+	#define TOKEN_END   (1 << 20) /* Stream checksum.              */
+	#define TOKEN_MARK  (1 << 21) /* Checkpoint.                   */
+	#define TOKEN_REF   (1 << 22) /* Chunk reference.              */
+	#define TOKEN_CUT   (1 << 23) /* End of entropy coded block.   */
+
+	/*
+	 * Asserts if a token carries a checksum.
+	 */
+	#define CHECKED(x) (((x) == TOKEN_CRC) || ((x) == TOKEN_END))
+
+	/*
+	 * Asserts if a token starts a stored segment.
+	 */
+	#define STORED(x) (((x) & ~0xffffu) == TOKEN_STORE)
+
+	/*
+	 * Longest stored segment, which is also the input
+	 * window tried at a time when storing data raw.
+	 */
+	#define STORE_WINDOW 8192
+
+#endif /* STREAM_H_ */
@@ -0,0 +1,49 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STRTAB_H_
+#define STRTAB_H_
+
+	#include <dictionary.h>
+	#include <shdict.h>
+
+/*============================================================================*
+ *                            Private Interface                               *
+ *============================================================================*/
+
+	/*
+	 * String table of a decoder. Entries are kept as their prefix
+	 * code and last character, and expanded back to front.
+	 */
+	struct strtab
+	{
+		int *parent;         /* Prefix code.      */
+		unsigned char *ch;   /* Last character.   */
+		unsigned char *buf;  /* Expansion buffer. */
+	};
+
+/*============================================================================*
+ *                             Public Interface                               *
+ *============================================================================*/
+
+	/* Forward definitions. */
+	extern unsigned strtab_expand(struct strtab *, unsigned);
+	extern unsigned strtab_init(struct strtab *, int, code_t, shdict_t);
+
+#endif /* STRTAB_H_ */
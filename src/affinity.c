@@ -0,0 +1,486 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <affinity.h>
+#include <assert.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <util.h>
+
+/*
+ * Topology information.
+ */
+#define SYSFS_CPU  "/sys/devices/system/cpu"  /* CPU topology.        */
+#define SYSFS_NODE "/sys/devices/system/node" /* NUMA topology.       */
+#define MAX_NODES  64                         /* Largest node probed. */
+#define CGROUP_FS  "/sys/fs/cgroup"           /* Control groups.      */
+
+/*
+ * Thread placement.
+ */
+struct affinity
+{
+	int node;                        /* Memory node (-1: any).     */
+	int pinned[AFFINITY_STAGES];     /* Stage pinned?              */
+	cpu_set_t cpus[AFFINITY_STAGES]; /* CPUs of each stage.        */
+	cpu_set_t pool;                  /* CPUs of pool workers.      */
+	int spread;                      /* One pool worker per CPU?   */
+};
+
+/*============================================================================*
+ *                                  Topology                                  *
+ *============================================================================*/
+
+/*
+ * Parses a CPU list, such as "0-3,8".
+ */
+static int affinity_parse(const char *list, cpu_set_t *set)
+{
+	const char *p;
+	char *end;
+
+	CPU_ZERO(set);
+
+	for (p = list; (*p != '\0') && (*p != '\n'); p = end)
+	{
+		long lo, hi;
+
+		lo = hi = strtol(p, &end, 10);
+		if (end == p)
+			return (-1);
+
+		/* Range. */
+		if (*end == '-')
+		{
+			p = end + 1;
+			hi = strtol(p, &end, 10);
+			if (end == p)
+				return (-1);
+		}
+
+		/* Bad range. */
+		if ((lo < 0) || (hi < lo) || (hi >= CPU_SETSIZE))
+			return (-1);
+
+		for (long cpu = lo; cpu <= hi; cpu++)
+			CPU_SET(cpu, set);
+
+		if (*end == ',')
+			end++;
+	}
+
+	return (0);
+}
+
+/*
+ * Reads a CPU list from a sysfs file.
+ */
+static int affinity_read(const char *path, cpu_set_t *set)
+{
+	FILE *file;
+	char line[1024];
+	int ret;
+
+	CPU_ZERO(set);
+
+	file = fopen(path, "r");
+	if (file == NULL)
+		return (-1);
+
+	ret = (fgets(line, sizeof(line), file) != NULL) ?
+		affinity_parse(line, set) : -1;
+
+	fclose(file);
+
+	return (ret);
+}
+
+/*
+ * Reads the CPUs that share some resource with a CPU.
+ */
+static void affinity_shared(int cpu, const char *what, cpu_set_t *set)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/%s", cpu, what);
+	affinity_read(path, set);
+}
+
+/*
+ * Reads the CPUs of a NUMA node.
+ */
+static int affinity_nodecpus(int node, cpu_set_t *set)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), SYSFS_NODE "/node%d/cpulist", node);
+	return (affinity_read(path, set));
+}
+
+/*
+ * Returns the NUMA node of a CPU, or -1 if unknown.
+ */
+static int affinity_cpunode(int cpu)
+{
+	cpu_set_t set;
+
+	for (int node = 0; node < MAX_NODES; node++)
+	{
+		if ((affinity_nodecpus(node, &set) == 0) && CPU_ISSET(cpu, &set))
+			return (node);
+	}
+
+	return (-1);
+}
+
+/*
+ * Reads the CPU quota of the calling process's cgroup, rounded up
+ * to whole CPUs. Returns zero if there is no quota.
+ */
+static int affinity_quota(void)
+{
+	FILE *file;
+	char path[1024];
+	char line[512];
+	long quota, period;
+
+	quota = period = 0;
+	path[0] = '\0';
+
+	/* Find our cgroup (v2). */
+	file = fopen("/proc/self/cgroup", "r");
+	if (file != NULL)
+	{
+		while (fgets(line, sizeof(line), file) != NULL)
+		{
+			if (!strncmp(line, "0::", 3))
+			{
+				line[strcspn(line, "\n")] = '\0';
+				snprintf(path, sizeof(path), CGROUP_FS "%s/cpu.max", line + 3);
+				break;
+			}
+		}
+		fclose(file);
+	}
+
+	/* cgroup v2: "<quota|max> <period>". */
+	if ((path[0] == '\0') || ((file = fopen(path, "r")) == NULL))
+		file = fopen(CGROUP_FS "/cpu.max", "r");
+	if (file != NULL)
+	{
+		if (fscanf(file, "%ld %ld", &quota, &period) != 2)
+			quota = period = 0;
+		fclose(file);
+	}
+
+	/* cgroup v1: separate files, -1 for no quota. */
+	else if ((file = fopen(CGROUP_FS "/cpu/cpu.cfs_quota_us", "r")) != NULL)
+	{
+		if (fscanf(file, "%ld", &quota) != 1)
+			quota = 0;
+		fclose(file);
+
+		file = fopen(CGROUP_FS "/cpu/cpu.cfs_period_us", "r");
+		if (file != NULL)
+		{
+			if (fscanf(file, "%ld", &period) != 1)
+				period = 0;
+			fclose(file);
+		}
+	}
+
+	if ((quota <= 0) || (period <= 0))
+		return (0);
+
+	return ((quota + period - 1)/period);
+}
+
+/*
+ * Returns the number of CPUs the calling process may use,
+ * honoring its affinity mask and cgroup CPU quota.
+ */
+int affinity_ncpus(void)
+{
+	cpu_set_t allowed;
+	int ncpus;
+	int quota;
+
+	ncpus = (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0) ?
+		CPU_COUNT(&allowed) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+	quota = affinity_quota();
+	if ((quota > 0) && (quota < ncpus))
+		ncpus = quota;
+
+	return ((ncpus > 0) ? ncpus : 1);
+}
+
+/*============================================================================*
+ *                                 Placement                                  *
+ *============================================================================*/
+
+/*
+ * Pins a stage to a set of CPUs.
+ */
+static void affinity_pin(struct affinity *a, int stage, const cpu_set_t *set)
+{
+	a->cpus[stage] = *set;
+	a->pinned[stage] = (CPU_COUNT(set) > 0);
+}
+
+/*
+ * Places the codec near the calling thread.
+ *
+ * All stages go to the CPUs that share the widest cache with the
+ * current one: the last level cache, else the L2 or SMT siblings.
+ * They keep sharing that cache, while the scheduler is left to
+ * spread the threads of many sessions created from one thread.
+ */
+static void affinity_auto(struct affinity *a, const cpu_set_t *allowed)
+{
+	static const char *levels[] = {
+		"cache/index3/shared_cpu_list",
+		"cache/index2/shared_cpu_list",
+		"topology/thread_siblings_list",
+		NULL
+	};
+	cpu_set_t near;
+	int cpu;
+
+	cpu = sched_getcpu();
+
+	/* Not allowed to run here, take the first allowed CPU. */
+	if ((cpu < 0) || !CPU_ISSET(cpu, allowed))
+	{
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if (CPU_ISSET(cpu, allowed))
+				break;
+		}
+
+		if (cpu == CPU_SETSIZE)
+			return;
+	}
+
+	CPU_ZERO(&near);
+	for (int i = 0; levels[i] != NULL; i++)
+	{
+		affinity_shared(cpu, levels[i], &near);
+		CPU_AND(&near, &near, allowed);
+
+		if (CPU_COUNT(&near) > 0)
+			break;
+	}
+
+	/* Topology unknown, stay on this CPU. */
+	if (CPU_COUNT(&near) == 0)
+		CPU_SET(cpu, &near);
+
+	for (int i = 0; i < AFFINITY_STAGES; i++)
+		affinity_pin(a, i, &near);
+
+	a->node = affinity_cpunode(cpu);
+}
+
+/*
+ * Creates a thread placement.
+ *
+ * The placement is given as "auto" (or NULL), "none", "node=<n>"
+ * to keep threads and memory on a NUMA node, or a comma separated
+ * list of CPUs for the reader, codec and writer threads. Pool
+ * workers get one CPU each, round robin over the listed CPUs, or
+ * share the CPUs of the NUMA node. Automatic placement leaves them
+ * to the scheduler within the allowed CPUs, since every process
+ * pinning its workers from the lowest allowed CPU up would stack
+ * them all on the same CPUs.
+ */
+struct affinity *affinity_create(const char *spec)
+{
+	struct affinity *a;
+	cpu_set_t allowed;
+
+	a = smalloc(sizeof(struct affinity));
+
+	/* Initialize placement. */
+	a->node = -1;
+	for (int i = 0; i < AFFINITY_STAGES; i++)
+	{
+		a->pinned[i] = 0;
+		CPU_ZERO(&a->cpus[i]);
+	}
+	CPU_ZERO(&a->pool);
+	a->spread = 0;
+
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) < 0)
+		return (a);
+
+	/* Scheduler decides. */
+	if ((spec != NULL) && (!strcmp(spec, "none")))
+		return (a);
+
+	/* Automatic placement. */
+	if ((spec == NULL) || (!strcmp(spec, "auto")))
+	{
+		affinity_auto(a, &allowed);
+		a->pool = allowed;
+	}
+
+	/* Whole NUMA node. */
+	else if (!strncmp(spec, "node=", 5))
+	{
+		cpu_set_t set;
+
+		a->node = atoi(spec + 5);
+		if ((a->node < 0) || (affinity_nodecpus(a->node, &set) < 0))
+			error("bad NUMA node");
+
+		CPU_AND(&set, &set, &allowed);
+		if (CPU_COUNT(&set) == 0)
+			error("no usable CPU on NUMA node");
+
+		for (int i = 0; i < AFFINITY_STAGES; i++)
+			affinity_pin(a, i, &set);
+		a->pool = set;
+	}
+
+	/* One CPU per stage, the last one repeats. */
+	else
+	{
+		const char *p = spec;
+		int cpu = -1;
+
+		for (int i = 0; i < AFFINITY_STAGES; i++)
+		{
+			cpu_set_t set;
+
+			if (*p != '\0')
+			{
+				char *end;
+
+				cpu = strtol(p, &end, 10);
+				if ((end == p) || (cpu < 0) || (cpu >= CPU_SETSIZE))
+					error("bad CPU list");
+				p = (*end == ',') ? end + 1 : end;
+			}
+
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			affinity_pin(a, i, &set);
+			CPU_SET(cpu, &a->pool);
+
+			/* Memory follows the codec thread. */
+			if (i == AFFINITY_WORKER)
+				a->node = affinity_cpunode(cpu);
+		}
+		a->spread = 1;
+	}
+
+	return (a);
+}
+
+/*
+ * Destroys a thread placement.
+ */
+void affinity_destroy(struct affinity *a)
+{
+	/* Sanity check. */
+	assert(a != NULL);
+
+	free(a);
+}
+
+/*
+ * Moves the calling thread to the CPUs of a pipeline stage.
+ *
+ * Failures are not fatal: the cpuset may forbid the move, in which
+ * case the scheduler keeps deciding.
+ */
+void affinity_apply(struct affinity *a, int stage)
+{
+	/* Sanity check. */
+	assert((stage >= 0) && (stage < AFFINITY_STAGES));
+
+	if ((a == NULL) || (!a->pinned[stage]))
+		return;
+
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &a->cpus[stage]);
+}
+
+/*
+ * Moves the calling thread to the CPUs of a pool worker.
+ */
+void affinity_pool(struct affinity *a, int worker)
+{
+	cpu_set_t set;
+	int n;
+
+	if ((a == NULL) || (CPU_COUNT(&a->pool) == 0))
+		return;
+
+	set = a->pool;
+
+	/* Worker-th CPU, round robin. */
+	if (a->spread)
+	{
+		n = worker % CPU_COUNT(&a->pool);
+
+		CPU_ZERO(&set);
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if ((CPU_ISSET(cpu, &a->pool)) && (n-- == 0))
+			{
+				CPU_SET(cpu, &set);
+				break;
+			}
+		}
+	}
+
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+}
+
+/*
+ * Returns the NUMA node that codec memory should live on.
+ */
+int affinity_node(struct affinity *a)
+{
+	return ((a != NULL) ? a->node : -1);
+}
+
+/*
+ * Asks for a page-aligned memory region to be placed on a NUMA node.
+ * Must be called before the region is touched.
+ */
+void affinity_bind(void *addr, size_t size, int node)
+{
+	unsigned long mask;
+
+	if ((node < 0) || (node >= MAX_NODES))
+		return;
+
+	mask = 1ul << node;
+	syscall(SYS_mbind, addr, size, MPOL_PREFERRED, &mask, MAX_NODES + 1, 0);
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <affinity.h>
+#include <arena.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <util.h>
+
+/*
+ * Arena.
+ */
+struct arena
+{
+	char *base;            /* Region.              */
+	size_t size;           /* Region size (bytes). */
+	size_t used;           /* Bytes handed out.    */
+	pthread_mutex_t mutex; /* Allocation lock.     */
+};
+
+/*
+ * Creates an arena with a fixed memory budget, optionally
+ * placed on a NUMA node (-1 for any).
+ *
+ * The whole region is touched up front, so that codec
+ * runs do not page fault on it later.
+ */
+struct arena *arena_create(size_t size, int node)
+{
+	struct arena *a;
+	size_t page;
+
+	/* Sanity check. */
+	assert(size > 0);
+
+	a = smalloc(sizeof(struct arena));
+
+	page = sysconf(_SC_PAGESIZE);
+	size = (size + page - 1) & ~(page - 1);
+
+	/* Initialize arena. */
+	a->base = aligned_alloc(page, size);
+	if (a->base == NULL)
+		error("cannot aligned_alloc()");
+	affinity_bind(a->base, size, node);
+	a->size = size;
+	a->used = 0;
+	memset(a->base, 0, size);
+
+	pthread_mutex_init(&a->mutex, NULL);
+
+	return (a);
+}
+
+/*
+ * Destroys an arena.
+ */
+void arena_destroy(struct arena *a)
+{
+	/* Sanity check. */
+	assert(a != NULL);
+
+	pthread_mutex_destroy(&a->mutex);
+
+	free(a->base);
+	free(a);
+}
+
+/*
+ * Allocates memory from an arena.
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+	void *p;
+	size_t align = alignof(max_align_t);
+
+	/* Sanity check. */
+	assert(a != NULL);
+
+	size = (size + align - 1) & ~(align - 1);
+
+	pthread_mutex_lock(&a->mutex);
+
+	/* Over budget. */
+	if (size > a->size - a->used)
+		error("arena exhausted");
+
+	p = a->base + a->used;
+	a->used += size;
+
+	pthread_mutex_unlock(&a->mutex);
+
+	return (p);
+}
+
+/*
+ * Releases all memory allocated from an arena.
+ */
+void arena_reset(struct arena *a)
+{
+	/* Sanity check. */
+	assert(a != NULL);
+
+	pthread_mutex_lock(&a->mutex);
+	a->used = 0;
+	pthread_mutex_unlock(&a->mutex);
+}
+
+/*
+ * Returns the number of bytes allocated from an arena.
+ */
+size_t arena_used(struct arena *a)
+{
+	size_t used;
+
+	/* Sanity check. */
+	assert(a != NULL);
+
+	pthread_mutex_lock(&a->mutex);
+	used = a->used;
+	pthread_mutex_unlock(&a->mutex);
+
+	return (used);
+}
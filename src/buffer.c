@@ -32,6 +32,7 @@ struct buffer
 	unsigned size;  /* Max size (in elements).      */
 	unsigned first; /* First element in the buffer. */
 	unsigned last;  /* Last element in the buffer.  */
+	arena_t arena;  /* Backing arena (may be NULL). */
 	pthread_mutex_t mutex_read;
 	pthread_mutex_t mutex_write;
 	sem_t sem_write;
@@ -39,20 +40,37 @@ struct buffer
 };
 
 /*
- * Creates a buffer.
+ * Memory used by a buffer carved from an arena.
  */
-struct buffer *buffer_create(unsigned size)
+size_t buffer_footprint(unsigned size)
+{
+	return (sizeof(struct buffer) + size*sizeof(unsigned) + 2*64);
+}
+
+/*
+ * Creates a buffer, carved from an arena if one is given.
+ */
+struct buffer *buffer_create(unsigned size, arena_t arena)
 {
 	struct buffer *buf;
 	
 	/* Sanity check. */
 	assert(size > 0);
 
-	buf = smalloc( sizeof( struct buffer ) );
+	if (arena != NULL)
+	{
+		buf = arena_alloc(arena, sizeof( struct buffer ) );
+		buf->data = arena_alloc(arena, size * sizeof ( unsigned ) );
+	}
+	else
+	{
+		buf = smalloc( sizeof( struct buffer ) );
+		buf->data = smalloc( size * sizeof ( unsigned ) );
+	}
 	
 	/* Initialize buffer. */
 	buf->size = size;
-	buf->data = smalloc( size * sizeof ( unsigned ) );
+	buf->arena = arena;
 	buf->first = 0;
 	buf->last = 0;
 
@@ -74,15 +92,18 @@ void buffer_destroy(struct buffer *buf)
 	assert(buf != NULL);
 	
 	/* House keeping. */
-	free(buf->data);
-
 	pthread_mutex_destroy(&buf->mutex_read);
 	pthread_mutex_destroy(&buf->mutex_write);
 
 	sem_destroy(&buf->sem_write);
 	sem_destroy(&buf->sem_read);
 
-	free(buf);
+	/* Arena memory is released with the arena. */
+	if (buf->arena == NULL)
+	{
+		free(buf->data);
+		free(buf);
+	}
 }
 
 /*
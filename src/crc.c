@@ -0,0 +1,221 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <crc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+	#include <nmmintrin.h>
+#endif
+
+/*
+ * CRC-32C (Castagnoli) polynomial, reflected.
+ */
+#define CRC32C_POLY 0x82f63b78u
+
+/*
+ * Lookup tables.
+ */
+static uint32_t crc32c_table[8][256]; /* Slicing-by-8 tables. */
+static uint32_t crc32c_x2n[32];       /* x^(2^n) mod P.       */
+static int crc32c_hw;                 /* SSE4.2 available?    */
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Multiplies two polynomials modulo P.
+ */
+static uint32_t crc32c_mult(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1u << 31;
+	uint32_t p = 0;
+
+	while (1)
+	{
+		if (a & m)
+		{
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+
+	return (p);
+}
+
+/*
+ * Computes x^(n*2^k) modulo P.
+ */
+static uint32_t crc32c_x2nmodp(size_t n, unsigned k)
+{
+	uint32_t p = 1u << 31;
+
+	while (n)
+	{
+		if (n & 1)
+			p = crc32c_mult(crc32c_x2n[k & 31], p);
+		n >>= 1;
+		k++;
+	}
+
+	return (p);
+}
+
+/*
+ * Builds lookup tables and probes the CPU.
+ */
+static void crc32c_init(void)
+{
+	uint32_t p;
+
+	for (unsigned i = 0; i < 256; i++)
+	{
+		uint32_t c = i;
+
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		crc32c_table[0][i] = c;
+	}
+
+	for (unsigned i = 0; i < 256; i++)
+	{
+		for (int t = 1; t < 8; t++)
+		{
+			uint32_t c = crc32c_table[t - 1][i];
+
+			crc32c_table[t][i] = (c >> 8) ^ crc32c_table[0][c & 0xff];
+		}
+	}
+
+	p = 1u << 30;
+	crc32c_x2n[0] = p;
+	for (int n = 1; n < 32; n++)
+		crc32c_x2n[n] = p = crc32c_mult(p, p);
+
+#if defined(__x86_64__)
+	crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/*
+ * Updates a CRC, eight bytes at a time.
+ */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t n)
+{
+	while ((n > 0) && ((uintptr_t)p & 7))
+	{
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+		n--;
+	}
+
+	while (n >= 8)
+	{
+		uint32_t lo, hi;
+
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+
+		crc = crc32c_table[7][lo & 0xff] ^
+			crc32c_table[6][(lo >> 8) & 0xff] ^
+			crc32c_table[5][(lo >> 16) & 0xff] ^
+			crc32c_table[4][lo >> 24] ^
+			crc32c_table[3][hi & 0xff] ^
+			crc32c_table[2][(hi >> 8) & 0xff] ^
+			crc32c_table[1][(hi >> 16) & 0xff] ^
+			crc32c_table[0][hi >> 24];
+
+		p += 8;
+		n -= 8;
+	}
+
+	while (n-- > 0)
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+
+	return (crc);
+}
+
+#if defined(__x86_64__)
+
+/*
+ * Updates a CRC with the SSE4.2 CRC32 instruction.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t n)
+{
+	uint64_t c = crc;
+
+	while ((n > 0) && ((uintptr_t)p & 7))
+	{
+		c = _mm_crc32_u8((uint32_t)c, *p++);
+		n--;
+	}
+
+	while (n >= 8)
+	{
+		uint64_t v;
+
+		memcpy(&v, p, 8);
+		c = _mm_crc32_u64(c, v);
+		p += 8;
+		n -= 8;
+	}
+
+	while (n-- > 0)
+		c = _mm_crc32_u8((uint32_t)c, *p++);
+
+	return ((uint32_t)c);
+}
+
+#endif
+
+/*
+ * Updates the CRC-32C of a byte stream. Start with zero.
+ */
+unsigned crc32c(unsigned crc, const void *data, size_t n)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+
+	crc = ~crc;
+
+#if defined(__x86_64__)
+	if (crc32c_hw)
+		return (~crc32c_sse42(crc, data, n));
+#endif
+
+	return (~crc32c_sw(crc, data, n));
+}
+
+/*
+ * Combines the CRC-32C of two adjacent pieces of data,
+ * given the length of the second one, so that pieces
+ * can be summed up in parallel.
+ */
+unsigned crc32c_combine(unsigned crc1, unsigned crc2, size_t len2)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+
+	return (crc32c_mult(crc32c_x2nmodp(len2, 3), crc1) ^ crc2);
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <arena.h>
+#include <crc.h>
+#include <dedup.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <util.h>
+
+/*
+ * Memory used by a history.
+ */
+size_t history_footprint(size_t size)
+{
+	return (sizeof(struct history) + size + 2*64);
+}
+
+/*
+ * Creates a history in an arena.
+ */
+struct history *history_create(size_t size, arena_t arena)
+{
+	struct history *h;
+
+	h = arena_alloc(arena, sizeof(struct history));
+	h->buf = arena_alloc(arena, size);
+	h->size = size;
+	h->len = 0;
+
+	return (h);
+}
+
+/*
+ * Appends data to a history.
+ */
+void history_put(struct history *h, const unsigned char *data, size_t n)
+{
+	while (n > 0)
+	{
+		size_t at = h->len & (h->size - 1);
+		size_t len = (n < h->size - at) ? n : h->size - at;
+
+		memcpy(&h->buf[at], data, len);
+		h->len += len;
+		data += len;
+		n -= len;
+	}
+}
+
+/*
+ * Asserts if n bytes that came dist bytes ago are still
+ * known, and end before the present.
+ */
+static int history_has(const struct history *h, uint64_t dist, size_t n)
+{
+	return ((n <= dist) && (dist <= h->len) && (dist <= h->size));
+}
+
+/*
+ * Copies n bytes that came dist bytes ago.
+ */
+static void history_get(const struct history *h, uint64_t dist, size_t n, unsigned char *dst)
+{
+	uint64_t from = h->len - dist;
+
+	while (n > 0)
+	{
+		size_t at = from & (h->size - 1);
+		size_t len = (n < h->size - at) ? n : h->size - at;
+
+		memcpy(dst, &h->buf[at], len);
+		from += len;
+		dst += len;
+		n -= len;
+	}
+}
+
+/*
+ * Resolves a chunk reference read from a stream.
+ */
+void history_deref(const struct history *h, uint64_t dist, size_t n, unsigned char *dst)
+{
+	/* Broken file. */
+	if ((h == NULL) || (n == 0) || (n > DEDUP_MAX) || (!history_has(h, dist, n)))
+		error("broken file");
+
+	history_get(h, dist, n, dst);
+}
+
+/*
+ * Gear hash table.
+ */
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Fills the gear hash table with pseudo-random values (splitmix64).
+ */
+static void gear_init(void)
+{
+	uint64_t x = 0;
+
+	for (int i = 0; i < 256; i++)
+	{
+		uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+
+		z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+/*
+ * Memory used by a chunker.
+ */
+size_t dedup_footprint(void)
+{
+	return (sizeof(struct dedup) + history_footprint(DEDUP_WINDOW) +
+		DEDUP_SLOTS*sizeof(struct fingerprint) + DEDUP_MAX + 3*64);
+}
+
+/*
+ * Creates a chunker in an arena.
+ */
+struct dedup *dedup_create(arena_t arena)
+{
+	struct dedup *dd;
+
+	pthread_once(&gear_once, gear_init);
+
+	dd = arena_alloc(arena, sizeof(struct dedup));
+	dd->hist = history_create(DEDUP_WINDOW, arena);
+	dd->table = arena_alloc(arena, DEDUP_SLOTS*sizeof(struct fingerprint));
+	dd->chunk = arena_alloc(arena, DEDUP_MAX);
+	dd->n = 0;
+	dd->hash = 0;
+
+	for (int i = 0; i < DEDUP_SLOTS; i++)
+	{
+		dd->table[i].offset = 0;
+		dd->table[i].len = 0;
+		dd->table[i].crc = 0;
+	}
+
+	return (dd);
+}
+
+/*
+ * Takes the pending chunk, which starts at some input offset.
+ * Returns the distance to an earlier copy of it, or zero.
+ */
+uint64_t dedup_chunk(struct dedup *dd, uint64_t offset)
+{
+	struct fingerprint *fp;
+	unsigned crc;
+	uint64_t dist;
+
+	crc = crc32c(0, dd->chunk, dd->n);
+	fp = &dd->table[crc & (DEDUP_SLOTS - 1)];
+	dist = offset - fp->offset;
+
+	if ((fp->len != dd->n) || (fp->crc != crc) || (!history_has(dd->hist, dist, dd->n)))
+		dist = 0;
+
+	/* Fingerprints may collide. */
+	else
+	{
+		unsigned char copy[DEDUP_MAX];
+
+		history_get(dd->hist, dist, dd->n, copy);
+		if (memcmp(copy, dd->chunk, dd->n))
+			dist = 0;
+	}
+
+	history_put(dd->hist, dd->chunk, dd->n);
+	fp->offset = offset;
+	fp->len = dd->n;
+	fp->crc = crc;
+
+	return (dist);
+}
+
+/*
+ * Adds input to the pending chunk, up to the next cut point.
+ * Returns the number of bytes taken, and asserts in *cut if
+ * they complete the chunk.
+ */
+size_t dedup_scan(struct dedup *dd, const unsigned char *data, size_t n, int *cut)
+{
+	for (size_t k = 0; k < n; k++)
+	{
+		dd->chunk[dd->n++] = data[k];
+		dd->hash = (dd->hash << 1) + gear[data[k]];
+
+		/* Cut point. */
+		if (((dd->n >= DEDUP_MIN) && (!(dd->hash & DEDUP_MASK))) || (dd->n == DEDUP_MAX))
+		{
+			*cut = 1;
+			return (k + 1);
+		}
+	}
+
+	*cut = 0;
+	return (n);
+}
@@ -38,21 +38,38 @@ void dictionary_reset(struct dictionary *dict)
 }
 
 /*
- * Creates a dictionary.
+ * Memory used by a dictionary carved from an arena.
  */
-struct dictionary *dictionary_create(int max_entries)
+size_t dictionary_footprint(int max_entries)
+{
+	return (sizeof(struct dictionary) + (max_entries + 1)*sizeof(struct entry) + 2*64);
+}
+
+/*
+ * Creates a dictionary, carved from an arena if one is given.
+ */
+struct dictionary *dictionary_create(int max_entries, arena_t arena)
 {
 	struct dictionary *dict;
 	
 	/* Sanity check. */
 	assert(max_entries > 0);
 	
-	dict = smalloc(sizeof(struct dictionary));
+	if (arena != NULL)
+	{
+		dict = arena_alloc(arena, sizeof(struct dictionary));
+		dict->entries = arena_alloc(arena, (max_entries + 1)*sizeof(struct entry));
+	}
+	else
+	{
+		dict = smalloc(sizeof(struct dictionary));
+		dict->entries = smalloc((max_entries + 1)*sizeof(struct entry));
+	}
 	
 	/* Initialize dictionary. */
 	dict->max_entries = (max_entries + 1);
 	dict->nentries = 1;
-	dict->entries = smalloc((max_entries + 1)*sizeof(struct entry));
+	dict->arena = arena;
 	for (int i = 0; i < (max_entries + 1); i++)
 	{
 		dict->entries[i].parent = -1;
@@ -71,6 +88,10 @@ void dictionary_destroy(struct dictionary *dict)
 	/* Sanity check. */
 	assert(dict != NULL);
 	
+	/* Arena memory is released with the arena. */
+	if (dict->arena != NULL)
+		return;
+	
 	free(dict->entries);
 	free(dict);
 }
@@ -0,0 +1,770 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <arena.h>
+#include <buffer.h>
+#include <entropy.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stream.h>
+#include <string.h>
+#include <util.h>
+
+/*
+ * Entropy coded streams are a sequence of blocks, each one starting at
+ * a byte boundary with its kind and number of codes. Fixed blocks hold
+ * codes the way plain streams do. Huffman blocks hold a table of code
+ * lengths and then codes as symbols of a canonical Huffman code. Either
+ * way, control codes are followed by padding and raw bytes, as usual.
+ */
+#define BLOCK_FIXED   0 /* Fixed width codes. */
+#define BLOCK_HUFFMAN 1 /* Huffman codes.     */
+
+/*
+ * Asserts if a control code is followed by padding.
+ */
+#define PADDED(x) (((x) >= CODE_FLUSH) && ((x) <= CODE_REF))
+
+/*
+ * Resets a symbol model.
+ */
+static void model_reset(struct model *m)
+{
+	m->max = RADIX + NCONTROL - 1;
+}
+
+/*
+ * Returns the bucket of a distance, and how many
+ * extra bits pick the distance within it.
+ */
+static unsigned model_bucket(unsigned d, unsigned *nextra)
+{
+	unsigned b;
+
+	if (d < 16)
+	{
+		*nextra = 0;
+		return (d);
+	}
+
+	for (b = 5; (d >> b) != 0; b++)
+		/* noop */ ;
+
+	*nextra = b - 3;
+
+	return (16 + 4*(b - 5) + ((d >> (b - 3)) & 3));
+}
+
+/*
+ * Returns the symbol of a code, along with its extra bits.
+ */
+static unsigned model_symbol(struct model *m, unsigned code, unsigned *extra, unsigned *nextra)
+{
+	unsigned d;
+	unsigned sym;
+
+	*extra = 0;
+	*nextra = 0;
+
+	/* Literal or control code. */
+	if (code < RADIX + NCONTROL)
+	{
+		if ((code == CODE_RESET) || (code == CODE_STORE))
+			model_reset(m);
+		return (code);
+	}
+
+	/* Below the highest code. */
+	if (code <= m->max)
+	{
+		d = m->max - code;
+		sym = RADIX + NCONTROL;
+	}
+
+	/* Past it. */
+	else
+	{
+		d = code - m->max - 1;
+		m->max = code;
+		sym = RADIX + NCONTROL + ENTROPY_BUCKETS;
+	}
+
+	sym += model_bucket(d, nextra);
+	*extra = d & ((1 << *nextra) - 1);
+
+	return (sym);
+}
+
+/*
+ * Compares symbols by frequency.
+ */
+static int entropy_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return ((x > y) - (x < y));
+}
+
+/*
+ * Computes Huffman code lengths for symbol frequencies. Frequencies
+ * are halved until no code is longer than ENTROPY_MAXLEN bits.
+ */
+static void entropy_lengths(const unsigned *freq, unsigned char *len)
+{
+	uint32_t key[ENTROPY_SIZE];          /* Frequency and symbol. */
+	unsigned f[ENTROPY_SIZE];            /* Working frequencies.  */
+	unsigned weight[2*ENTROPY_SIZE];     /* Node weights.         */
+	unsigned parent[2*ENTROPY_SIZE];     /* Node parents.         */
+	unsigned char depth[2*ENTROPY_SIZE]; /* Node depths.          */
+
+	memcpy(f, freq, sizeof(f));
+	memset(len, 0, ENTROPY_SIZE);
+
+	while (1)
+	{
+		unsigned n = 0;
+		unsigned i, j, k;
+		unsigned longest = 0;
+
+		for (unsigned sym = 0; sym < ENTROPY_SIZE; sym++)
+		{
+			if (f[sym] > 0)
+				key[n++] = (f[sym] << 9) | sym;
+		}
+
+		if (n == 0)
+			return;
+
+		/* A code needs at least one bit. */
+		if (n == 1)
+		{
+			len[key[0] & 0x1ff] = 1;
+			return;
+		}
+
+		qsort(key, n, sizeof(uint32_t), entropy_cmp);
+
+		/*
+		 * Leaves come first, lightest first, and so do inner
+		 * nodes as they are made, so the two lightest nodes are
+		 * always at the front of either list.
+		 */
+		for (k = 0; k < n; k++)
+			weight[k] = key[k] >> 9;
+		for (i = 0, j = n; k < 2*n - 1; k++)
+		{
+			unsigned a, b;
+
+			a = ((i < n) && ((j == k) || (weight[i] <= weight[j]))) ? i++ : j++;
+			b = ((i < n) && ((j == k) || (weight[i] <= weight[j]))) ? i++ : j++;
+
+			weight[k] = weight[a] + weight[b];
+			parent[a] = parent[b] = k;
+		}
+
+		/* Parents come after their children. */
+		depth[2*n - 2] = 0;
+		for (k = 2*n - 2; k-- > 0; /* noop */)
+		{
+			depth[k] = depth[parent[k]] + 1;
+			if ((k < n) && (depth[k] > longest))
+				longest = depth[k];
+		}
+
+		if (longest <= ENTROPY_MAXLEN)
+		{
+			for (k = 0; k < n; k++)
+				len[key[k] & 0x1ff] = depth[k];
+			return;
+		}
+
+		for (unsigned sym = 0; sym < ENTROPY_SIZE; sym++)
+			f[sym] = (f[sym] + 1)/2;
+	}
+}
+
+/*
+ * Assigns canonical Huffman codes to code lengths. Returns
+ * non-zero if the lengths do not make up a prefix code.
+ */
+static int entropy_codes(const unsigned char *len, unsigned *code)
+{
+	unsigned count[ENTROPY_MAXLEN + 1];
+	unsigned next[ENTROPY_MAXLEN + 1];
+	unsigned kraft = 0;
+	unsigned c = 0;
+
+	memset(count, 0, sizeof(count));
+	for (unsigned sym = 0; sym < ENTROPY_SIZE; sym++)
+	{
+		count[len[sym]]++;
+		if (len[sym] != 0)
+			kraft += 1 << (ENTROPY_MAXLEN - len[sym]);
+	}
+
+	/* Over-subscribed. */
+	if (kraft > (1 << ENTROPY_MAXLEN))
+		return (-1);
+
+	count[0] = 0;
+	for (unsigned l = 1; l <= ENTROPY_MAXLEN; l++)
+	{
+		c = (c + count[l - 1]) << 1;
+		next[l] = c;
+	}
+
+	for (unsigned sym = 0; sym < ENTROPY_SIZE; sym++)
+	{
+		if (len[sym] != 0)
+			code[sym] = next[len[sym]]++;
+	}
+
+	return (0);
+}
+
+/*
+ * Returns the number of raw bytes after a padded control
+ * code, given the raw bytes that come next.
+ */
+static size_t entropy_raw(unsigned code, const unsigned char *raw)
+{
+	if (code == CODE_STORE)
+		return (2 + ((raw[0] << 8) | raw[1]));
+	if (code == CODE_REF)
+		return (6);
+
+	return ((code == CODE_FLUSH) ? 0 : 4);
+}
+
+/*
+ * Memory used by a packer.
+ */
+size_t packer_footprint(void)
+{
+	return (ENTROPY_SYMBOLS*sizeof(unsigned short) + ENTROPY_RAW + 2*64);
+}
+
+/*
+ * Largest block a packer writes.
+ */
+size_t packer_room(void)
+{
+	return (3 + 3*ENTROPY_SYMBOLS + ENTROPY_RAW);
+}
+
+/*
+ * Initializes a packer.
+ */
+void packer_init(struct packer *pk, arena_t arena, unsigned char *out)
+{
+	pk->codes = arena_alloc(arena, ENTROPY_SYMBOLS*sizeof(unsigned short));
+	pk->raw = arena_alloc(arena, ENTROPY_RAW);
+	pk->ncodes = 0;
+	pk->nraw = 0;
+	pk->pending = 0;
+	pk->buf = 0;
+	pk->n = 0;
+	pk->out = out;
+	pk->len = 0;
+}
+
+/*
+ * Packs some bits.
+ */
+static void packer_bits(struct packer *pk, unsigned bits, unsigned n)
+{
+	pk->buf = (pk->buf << n) | bits;
+	pk->n += n;
+
+	while (pk->n >= 8)
+	{
+		pk->out[pk->len++] = (pk->buf >> (pk->n - 8)) & 0xff;
+		pk->n -= 8;
+	}
+}
+
+/*
+ * Pads a packer to a byte boundary.
+ */
+static void packer_align(struct packer *pk)
+{
+	if (pk->n > 0)
+		pk->out[pk->len++] = (pk->buf << (8 - pk->n)) & 0xff;
+	pk->n = 0;
+}
+
+/*
+ * Writes a table of code lengths, four bits each, with runs of unused
+ * symbols as a zero and the run length. Returns the size of the table
+ * in bits, and only sizes it up if there is no packer.
+ */
+static unsigned entropy_table(const unsigned char *len, struct packer *pk)
+{
+	unsigned bits = 0;
+
+	for (unsigned sym = 0; sym < ENTROPY_SIZE; /* noop */)
+	{
+		unsigned run = 0;
+
+		/* Used symbol. */
+		if (len[sym] != 0)
+		{
+			if (pk != NULL)
+				packer_bits(pk, len[sym], 4);
+			bits += 4;
+			sym++;
+			continue;
+		}
+
+		while ((sym + run < ENTROPY_SIZE) && (len[sym + run] == 0) && (run < 16))
+			run++;
+
+		if (pk != NULL)
+		{
+			packer_bits(pk, 0, 4);
+			packer_bits(pk, run - 1, 4);
+		}
+		bits += 8;
+		sym += run;
+	}
+
+	return (bits);
+}
+
+/*
+ * Writes the codes held back as a block. Huffman codes are used
+ * only if the block surely comes out shorter, padding included.
+ */
+void packer_block(struct packer *pk)
+{
+	unsigned freq[ENTROPY_SIZE];     /* Symbol frequencies. */
+	unsigned char len[ENTROPY_SIZE]; /* Code lengths.       */
+	unsigned code[ENTROPY_SIZE];     /* Symbol codes.       */
+	unsigned extra, nextra;          /* Extra bits.         */
+	struct model m;                  /* Symbol model.       */
+	int kind;                        /* Block kind.         */
+	size_t r;                        /* Raw bytes written.  */
+
+	if (pk->ncodes == 0)
+		return;
+
+	kind = BLOCK_FIXED;
+	model_reset(&m);
+
+	/* Huffman codes, if worth it. */
+	if (pk->ncodes >= ENTROPY_MINSYMS)
+	{
+		uint64_t bits = 0;
+		size_t npadded = 0;
+
+		memset(freq, 0, sizeof(freq));
+		for (size_t k = 0; k < pk->ncodes; k++)
+		{
+			freq[model_symbol(&m, pk->codes[k], &extra, &nextra)]++;
+			bits += nextra;
+			if (PADDED(pk->codes[k]))
+				npadded++;
+		}
+
+		entropy_lengths(freq, len);
+		for (unsigned sym = 0; sym < ENTROPY_SIZE; sym++)
+			bits += (uint64_t) freq[sym]*len[sym];
+		bits += entropy_table(len, NULL) + 7*(npadded + 1);
+
+		if (bits < (uint64_t) WIDTH*pk->ncodes)
+			kind = BLOCK_HUFFMAN;
+	}
+
+	packer_bits(pk, kind, 8);
+	packer_bits(pk, pk->ncodes, 16);
+
+	if (kind == BLOCK_HUFFMAN)
+	{
+		entropy_table(len, pk);
+		entropy_codes(len, code);
+		model_reset(&m);
+	}
+
+	r = 0;
+	for (size_t k = 0; k < pk->ncodes; k++)
+	{
+		unsigned c = pk->codes[k];
+
+		if (kind == BLOCK_HUFFMAN)
+		{
+			unsigned sym = model_symbol(&m, c, &extra, &nextra);
+
+			packer_bits(pk, code[sym], len[sym]);
+			if (nextra > 0)
+				packer_bits(pk, extra, nextra);
+		}
+		else
+			packer_bits(pk, c, WIDTH);
+
+		/* Padding and raw bytes. */
+		if (PADDED(c))
+		{
+			size_t n = entropy_raw(c, &pk->raw[r]);
+
+			packer_align(pk);
+			memcpy(&pk->out[pk->len], &pk->raw[r], n);
+			pk->len += n;
+			r += n;
+		}
+	}
+
+	packer_align(pk);
+
+	pk->ncodes = 0;
+	pk->nraw = 0;
+}
+
+/*
+ * Ends a block if its last code ended it, or if it is full.
+ */
+static void packer_cut(struct packer *pk)
+{
+	unsigned code = pk->codes[pk->ncodes - 1];
+
+	if ((code == CODE_FLUSH) || (code == CODE_END) ||
+		(pk->ncodes == ENTROPY_SYMBOLS) ||
+		(pk->nraw > ENTROPY_RAW - (2 + STORE_WINDOW)))
+		packer_block(pk);
+}
+
+/*
+ * Packs a code, given as for bitwriter_put(). Blocks end at sync
+ * flushes, so that the decoder can catch up. Stream checksums come
+ * in a fixed block of their own, so that members end the same way
+ * with or without entropy coding.
+ */
+void packer_put(struct packer *pk, unsigned code)
+{
+	/* Raw byte. */
+	if (pk->pending > 0)
+	{
+		pk->raw[pk->nraw++] = code & 0xff;
+		if (--pk->pending == 0)
+			packer_cut(pk);
+		return;
+	}
+
+	/* Control tokens. */
+	if (code == TOKEN_FLUSH)
+		code = CODE_FLUSH;
+	else if (STORED(code))
+	{
+		pk->pending = code & 0xffff;
+		pk->raw[pk->nraw++] = (pk->pending >> 8) & 0xff;
+		pk->raw[pk->nraw++] = pk->pending & 0xff;
+		code = CODE_STORE;
+	}
+	else if (CHECKED(code))
+	{
+		pk->pending = 4;
+		code = (code == TOKEN_CRC) ? CODE_CRC : CODE_END;
+	}
+	else if (code == TOKEN_REF)
+	{
+		pk->pending = 6;
+		code = CODE_REF;
+	}
+
+	if (code == CODE_END)
+		packer_block(pk);
+
+	pk->codes[pk->ncodes++] = code;
+
+	if (pk->pending == 0)
+		packer_cut(pk);
+}
+
+/*
+ * Writes whatever is held back.
+ */
+void packer_end(struct packer *pk)
+{
+	packer_block(pk);
+}
+
+/*
+ * Initializes an unpacker.
+ */
+void unpacker_init(struct unpacker *u, FILE *in, buffer_t src)
+{
+	u->in = in;
+	u->src = src;
+	u->mem = NULL;
+	u->avail = 0;
+	u->buf = 0;
+	u->n = 0;
+	u->over = 0;
+	u->kind = BLOCK_FIXED;
+	u->left = 0;
+	u->word = 0;
+}
+
+/*
+ * Initializes an unpacker that reads from a byte array.
+ */
+void unpacker_memory(struct unpacker *u, const unsigned char *data, size_t n)
+{
+	unpacker_init(u, NULL, NULL);
+	u->mem = data;
+	u->avail = n;
+}
+
+/*
+ * Reads an input byte.
+ */
+static int unpacker_getc(struct unpacker *u)
+{
+	/* Buffers hold a single end of input. */
+	if (u->src != NULL)
+		return ((u->over > 0) ? EOF : (int) buffer_get(u->src));
+
+	if (u->mem != NULL)
+	{
+		if (u->avail == 0)
+			return (EOF);
+		u->avail--;
+		return (*u->mem++);
+	}
+
+	return (getc(u->in));
+}
+
+/*
+ * Reads bytes until some bits are at hand. Past the end
+ * of the file, zeros are read, which must not be used.
+ */
+static void unpacker_fill(struct unpacker *u, unsigned n)
+{
+	while (u->n < n)
+	{
+		int ch = unpacker_getc(u);
+
+		if (ch == EOF)
+		{
+			ch = 0;
+			u->over += 8;
+		}
+
+		u->buf = (u->buf << 8) | ch;
+		u->n += 8;
+	}
+}
+
+/*
+ * Unpacks up to 16 bits.
+ */
+static unsigned unpacker_bits(struct unpacker *u, unsigned n)
+{
+	unpacker_fill(u, n);
+
+	u->n -= n;
+	if (u->n < u->over)
+		error("broken file");
+
+	return ((u->buf >> u->n) & ((1 << n) - 1));
+}
+
+/*
+ * Skips padding to a byte boundary.
+ */
+static void unpacker_align(struct unpacker *u)
+{
+	u->n -= u->n & 7;
+}
+
+/*
+ * Unpacks a raw byte.
+ */
+unsigned unpacker_byte(struct unpacker *u)
+{
+	return (unpacker_bits(u, 8));
+}
+
+/*
+ * Starts the next block. Returns zero at end of input.
+ */
+static int unpacker_block(struct unpacker *u)
+{
+	unsigned char len[ENTROPY_SIZE];
+	unsigned code[ENTROPY_SIZE];
+
+	unpacker_align(u);
+
+	/* End of input. */
+	if (u->n == u->over)
+	{
+		int ch;
+
+		if ((u->over > 0) || ((ch = unpacker_getc(u)) == EOF))
+			return (0);
+
+		u->buf = (u->buf << 8) | ch;
+		u->n += 8;
+	}
+
+	u->kind = unpacker_bits(u, 8);
+	u->left = unpacker_bits(u, 16);
+	model_reset(&u->m);
+
+	if ((u->kind > BLOCK_HUFFMAN) || (u->left == 0))
+		error("broken file");
+
+	if (u->kind == BLOCK_FIXED)
+		return (1);
+
+	/* Code lengths. */
+	for (unsigned sym = 0; sym < ENTROPY_SIZE; /* noop */)
+	{
+		unsigned l = unpacker_bits(u, 4);
+		unsigned run;
+
+		if (l != 0)
+		{
+			if (l > ENTROPY_MAXLEN)
+				error("broken file");
+			len[sym++] = l;
+			continue;
+		}
+
+		run = unpacker_bits(u, 4) + 1;
+		if (sym + run > ENTROPY_SIZE)
+			error("broken file");
+		while (run-- > 0)
+			len[sym++] = 0;
+	}
+
+	if (entropy_codes(len, code))
+		error("broken file");
+
+	/* Decoding table, indexed by the next bits. */
+	memset(u->table, 0, sizeof(u->table));
+	for (unsigned sym = 0; sym < ENTROPY_SIZE; sym++)
+	{
+		unsigned shift = ENTROPY_MAXLEN - len[sym];
+
+		if (len[sym] == 0)
+			continue;
+
+		for (unsigned k = code[sym] << shift; k < (code[sym] + 1) << shift; k++)
+			u->table[k] = (len[sym] << 9) | sym;
+	}
+
+	return (1);
+}
+
+/*
+ * Unpacks a Huffman coded symbol and returns its code.
+ */
+static unsigned unpacker_symbol(struct unpacker *u)
+{
+	unsigned entry;
+	unsigned sym;
+	unsigned k, d;
+
+	unpacker_fill(u, ENTROPY_MAXLEN);
+
+	entry = u->table[(u->buf >> (u->n - ENTROPY_MAXLEN)) & ((1 << ENTROPY_MAXLEN) - 1)];
+
+	/* Not a symbol. */
+	if (entry == 0)
+		error("broken file");
+
+	u->n -= entry >> 9;
+	if (u->n < u->over)
+		error("broken file");
+
+	sym = entry & 0x1ff;
+
+	/* Literal or control code. */
+	if (sym < RADIX + NCONTROL)
+	{
+		if ((sym == CODE_RESET) || (sym == CODE_STORE))
+			model_reset(&u->m);
+		return (sym);
+	}
+
+	/* Distance. */
+	k = (sym - RADIX - NCONTROL) % ENTROPY_BUCKETS;
+	d = k;
+	if (k >= 16)
+	{
+		unsigned nextra = (k - 16)/4 + 2;
+
+		d = ((4 | ((k - 16) & 3)) << nextra) | unpacker_bits(u, nextra);
+	}
+
+	/* Below the highest code. */
+	if (sym < RADIX + NCONTROL + ENTROPY_BUCKETS)
+	{
+		if (d > u->m.max - (RADIX + NCONTROL))
+			error("broken file");
+		return (u->m.max - d);
+	}
+
+	/* Past it. */
+	if (d >= ((1 << WIDTH) - 1) - u->m.max)
+		error("broken file");
+
+	u->m.max += d + 1;
+
+	return (u->m.max);
+}
+
+/*
+ * Unpacks a code, returned as by bitreader_put(). Raw bytes after it
+ * are read with unpacker_byte(). Returns EOF at end of input.
+ */
+unsigned unpacker_get(struct unpacker *u)
+{
+	unsigned code;
+
+	/* Next block. */
+	if ((u->left == 0) && (!unpacker_block(u)))
+		return (EOF);
+
+	u->left--;
+
+	code = (u->kind == BLOCK_HUFFMAN) ?
+		unpacker_symbol(u) : unpacker_bits(u, WIDTH);
+
+	if (!PADDED(code))
+		return (code);
+
+	unpacker_align(u);
+
+	if (code == CODE_FLUSH)
+		return (TOKEN_FLUSH);
+	if (code == CODE_STORE)
+		return (TOKEN_STORE | unpacker_bits(u, 16));
+
+	/* Checksum or distance. */
+	u->word = unpacker_bits(u, 16) << 16;
+	u->word |= unpacker_bits(u, 16);
+
+	if (code == CODE_REF)
+		return (TOKEN_REF);
+
+	return ((code == CODE_CRC) ? TOKEN_CRC : TOKEN_END);
+}
@@ -1,365 +1,4100 @@
 /*
  * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
- * 
+ *
  * This file is part of compress.
- * 
+ *
  * compress is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation; either version 3 of the License, or
  * (at your option) any later version.
- * 
+ *
  * compress is distributed in the hope that it will be useful,
  * but WITHOUT ANY WARRANTY; without even the implied warranty of
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  * GNU General Public License for more details.
- * 
+ *
  * You should have received a copy of the GNU General Public License
  * along with compress. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <affinity.h>
+#include <arena.h>
 #include <buffer.h>
+#include <crc.h>
+#include <dedup.h>
 #include <dictionary.h>
+#include <entropy.h>
+#include <errno.h>
+#include <global.h>
+#include <math.h>
+#include <poll.h>
+#include <pool.h>
+#include <search.h>
+#include <shdict.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stream.h>
 #include <string.h>
+#include <strtab.h>
+#include <time.h>
+#include <unistd.h>
 #include <util.h>
 #include <pthread.h>
 
-/* 
- * Parameters.
+/*
+ * Stored segment parameters. Windows are STORE_WINDOW bytes.
+ */
+#define STORE_OVERHEAD 4    /* Stored segment overhead (bytes).    */
+#define STORE_BACKOFF  16   /* Maximum windows stored untried.     */
+#define STORE_PROBE    1024 /* Input probed in windows not tried.  */
+
+/*
+ * Checksum parameters.
+ */
+#define CRC_SEGMENT (1 << 20) /* Checksummed segment size (bytes). */
+
+/*
+ * Estimation parameters. Inputs that fit in the sampling budget
+ * are compressed whole, larger ones are sampled at evenly spaced
+ * windows.
+ */
+#define ESTIMATE_WINDOW  (1 << 16) /* Sampled window (bytes). */
+#define ESTIMATE_WINDOWS 16        /* Windows sampled.        */
+
+/*
+ * Sync flush parameters.
+ */
+#define FLUSH_TICK   50   /* Polling period for explicit flushes (ms). */
+#define FLUSH_CHUNK  4096 /* Read size when flushing is enabled.       */
+
+/*
+ * Session parameters.
+ */
+#define BUFFER_SIZE    5096      /* Ring buffer size (in elements). */
+#define SESSION_MEMORY (1 << 18) /* Smallest default memory budget. */
+#define READ_CHUNK     4096      /* Byte reader read size.          */
+#define WRITE_CHUNK    4096      /* Bit writer staging size.        */
+#define BLOCK_SIZE     (1 << 18) /* Default block size.             */
+#define VERIFY_CUT     (1 << 15) /* Input per block when verifying. */
+
+/*
+ * Block of input compressed by a pool worker.
  */
-#define RADIX 256 /* Radix of input data. */
-#define WIDTH  12 /* Width of code word.  */
+struct block
+{
+	struct lzw_session *s; /* Session.            */
+	int first;             /* First block?        */
+	unsigned char *in;     /* Input data.         */
+	size_t n;              /* Input size.         */
+	unsigned char *out;    /* Compressed data.    */
+	size_t len;            /* Compressed size.    */
+	dictionary_t dict;     /* Dictionary.         */
+	code_t code;           /* Last code given.    */
+	struct decoder *check; /* Verifier (or NULL). */
+	struct storer *store;  /* Storer (or NULL).   */
+	struct packer *pack;   /* Packer (or NULL).   */
+	unsigned crc;          /* Input checksum.     */
+	size_t checked;        /* Bytes verified.     */
+};
 
-buffer_t inbuf;  /* Input buffer.  */
-buffer_t outbuf; /* Output buffer. */
+/*
+ * Codec session.
+ *
+ * All memory used by a codec run is carved from the session arena,
+ * which is reset, not freed, between runs.
+ */
+struct lzw_session
+{
+	struct lzw_options opts; /* Options.                      */
+	arena_t arena;           /* Codec memory.                 */
+	affinity_t affinity;     /* Thread placement.             */
+	atomic_int flush;        /* Explicit sync flush pending?  */
+	buffer_t inbuf;          /* Input buffer.                 */
+	buffer_t outbuf;         /* Output buffer.                */
+	buffer_t refbuf;         /* Input copy (verify mode).     */
+	buffer_t chkbuf;         /* Output copy (verify mode).    */
+	FILE *input;             /* Input file.                   */
+	FILE *output;            /* Output file.                  */
+	int control;             /* Control codes?                */
+	code_t first;            /* First free code.              */
+	int crc;                 /* Stream checksum?              */
+	int entropy;             /* Entropy coded?                */
+	unsigned total;          /* Stream checksum (pool mode).  */
+	unsigned nblocks;        /* Blocks in flight (pool mode). */
+	shdict_t resume;         /* Dictionary to resume from.    */
+	shdict_t trail;          /* Dictionary left behind.       */
+	struct checkpoint *ckpt; /* Resumed checkpoint (or NULL). */
+	uint64_t offset;         /* Input offset.                 */
+	uint64_t mark;           /* Offset of next checkpoint.    */
+	uint64_t interval;       /* Checkpoint interval.          */
+	double pace;             /* Pipeline/block time (0: n/a). */
+	struct dedup *dedup;     /* Chunker (dedup mode).         */
+	struct history *history; /* Output history (dedup mode).  */
+	int grow;                /* Default memory budget?        */
+};
 
 /*============================================================================*
  *                           Bit Buffer Reader/Writer                         *
  *============================================================================*/
 
 /*
- * Writes data to a file.
+ * Bit writer. Packs codes into a caller-drained byte array, which
+ * must have room for five more bytes before each code.
  */
-static void* lzw_writebits(void* arg)
+struct bitwriter
 {
-	int bits;   /* Working bits. */
-	unsigned n; /* Current bit.  */
-	int buf;    /* Buffer.       */
-	
-	n = 0;
-	buf = 0;
-	
-	FILE *out = (FILE *)arg;
+	unsigned buf;       /* Working bits.          */
+	unsigned n;         /* Number of bits.        */
+	unsigned char *out; /* Output bytes.          */
+	size_t len;         /* Output length.         */
+	unsigned raw;       /* Stored bytes to come.  */
+};
 
-	/*
-	 * Read data from input buffer
-	 * and write to output file.
-	 */
-	while ((bits = buffer_get(outbuf)) != EOF)
-	{	
-		buf  = buf << WIDTH;
-		buf |= bits & ((1 << WIDTH) - 1);
-		n += WIDTH;
-				
-		/* Flush bytes. */
-		while (n >= 8)
-		{
-			fputc((buf >> (n - 8)) & 0xff, out);
-			n -= 8;
-		}
+/*
+ * Pads a bit writer to a byte boundary.
+ */
+static void bitwriter_align(struct bitwriter *bw)
+{
+	if (bw->n > 0)
+		bw->out[bw->len++] = (bw->buf << (8 - bw->n)) & 0xff;
+	bw->n = 0;
+}
+
+/*
+ * Packs a code. Sync flushes are written as the flush control
+ * code followed by padding to a byte boundary. Stored segments
+ * are written as the store control code, padding, a 16-bit
+ * length and that many raw bytes, which are the next codes.
+ * Checksums are written as their control code, padding and
+ * four raw bytes, which are the next codes as well. So are chunk
+ * references, with six raw bytes: distance and length.
+ */
+static void bitwriter_put(struct bitwriter *bw, unsigned code)
+{
+	unsigned raw = 0;
+	int store = STORED(code);
+	int align = 1;
+
+	/* Stored byte. */
+	if (bw->raw > 0)
+	{
+		bw->out[bw->len++] = code & 0xff;
+		bw->raw--;
+		return;
 	}
-	
-	if (n > 0)
-		fputc((buf << (8 - n)) & 0xff, out);
 
-	return NULL;
+	/* Control tokens. */
+	if (code == TOKEN_FLUSH)
+		code = CODE_FLUSH;
+	else if (store)
+	{
+		raw = code & 0xffff;
+		code = CODE_STORE;
+	}
+	else if (CHECKED(code))
+	{
+		raw = 4;
+		code = (code == TOKEN_CRC) ? CODE_CRC : CODE_END;
+	}
+	else if (code == TOKEN_REF)
+	{
+		raw = 6;
+		code = CODE_REF;
+	}
+	else
+		align = 0;
+
+	bw->buf  = bw->buf << WIDTH;
+	bw->buf |= code & ((1 << WIDTH) - 1);
+	bw->n += WIDTH;
+
+	/* Flush bytes. */
+	while (bw->n >= 8)
+	{
+		bw->out[bw->len++] = (bw->buf >> (bw->n - 8)) & 0xff;
+		bw->n -= 8;
+	}
+
+	if (align)
+		bitwriter_align(bw);
+
+	/* Regular codes may match control codes in headerless streams. */
+	if (store)
+	{
+		bw->out[bw->len++] = (raw >> 8) & 0xff;
+		bw->out[bw->len++] = raw & 0xff;
+	}
+
+	bw->raw = raw;
+}
+
+/*
+ * Initializes a bit writer.
+ */
+static void bitwriter_init(struct bitwriter *bw, unsigned char *out)
+{
+	bw->buf = 0;
+	bw->n = 0;
+	bw->out = out;
+	bw->len = 0;
+	bw->raw = 0;
+}
+
+/*
+ * Bit reader.
+ */
+struct bitreader
+{
+	unsigned buf;   /* Working bits.               */
+	unsigned n;     /* Number of bits.             */
+	int control;    /* Control codes?              */
+	unsigned kind;  /* Control code being read.    */
+	unsigned word;  /* Length or checksum.         */
+	int nword;      /* Bytes of it still to come.  */
+};
+
+/*
+ * Initializes a bit reader.
+ */
+static void bitreader_init(struct bitreader *br, int control)
+{
+	br->buf = 0;
+	br->n = 0;
+	br->control = control;
+	br->kind = 0;
+	br->word = 0;
+	br->nword = 0;
+}
+
+/*
+ * Unpacks a byte. Returns the code it completes, or TOKEN_NONE.
+ *
+ * A stored segment is returned as TOKEN_STORE plus its length,
+ * and the caller is expected to copy that many bytes itself.
+ * Checksums are returned as TOKEN_CRC or TOKEN_END, with the
+ * checksum left in the word field. Chunk references are returned
+ * as TOKEN_REF, with the distance left in the word field, and the
+ * caller is expected to read the 16-bit length itself.
+ */
+static unsigned bitreader_put(struct bitreader *br, int byte)
+{
+	unsigned code;
+
+	/* Length or checksum. */
+	if (br->nword > 0)
+	{
+		br->word = (br->word << 8) | (byte & 0xff);
+		if (--br->nword > 0)
+			return (TOKEN_NONE);
+
+		if (br->kind == CODE_STORE)
+			return (TOKEN_STORE | br->word);
+		if (br->kind == CODE_REF)
+			return (TOKEN_REF);
+
+		return ((br->kind == CODE_CRC) ? TOKEN_CRC : TOKEN_END);
+	}
+
+	br->buf = (br->buf << 8) | (byte & 0xff);
+	br->n += 8;
+
+	if (br->n < WIDTH)
+		return (TOKEN_NONE);
+
+	br->n -= WIDTH;
+	code = (br->buf >> br->n) & ((1 << WIDTH) - 1);
+
+	if (!br->control)
+		return (code);
+
+	/* Sync flush, skip padding. */
+	if (code == CODE_FLUSH)
+	{
+		br->n = 0;
+		return (TOKEN_FLUSH);
+	}
+
+	/* Stored segment, checksum or reference, skip padding. */
+	if ((code == CODE_STORE) || (code == CODE_CRC) ||
+		(code == CODE_END) || (code == CODE_REF))
+	{
+		br->n = 0;
+		br->kind = code;
+		br->word = 0;
+		br->nword = (code == CODE_STORE) ? 2 : 4;
+		return (TOKEN_NONE);
+	}
+
+	return (code);
 }
 
 /*============================================================================*
- *                           Bit Buffer Reader/Writer                         *
+ *                                   LZW                                      *
  *============================================================================*/
 
 /*
- * Reads data from a file.
+ * Initializes dictionary.
  */
-static void* lzw_readbits(void* arg)
+static code_t lzw_init(dictionary_t dict, int radix, code_t first, shdict_t shdict)
 {
-	int bits;   /* Working bits. */
-	unsigned n; /* Current bit.  */
-	int buf;    /* Buffer.       */
-	
-	n = 0;
-	buf = 0;
+	for (int i = 0; i < radix; i++)
+		dictionary_add(dict, 0, i, i);
+
+	if (shdict == NULL)
+		return (first - 1);
 
-	FILE *in = (FILE *)arg;
-	
 	/*
-	 * Read data from input file
-	 * and write to output buffer.
+	 * Prime with shared dictionary. Entry k
+	 * lives right after the control codes.
 	 */
-	while ((bits = fgetc(in)) != EOF)
-	{	
-		buf = buf << 8;
-		buf |= bits & 0xff;
-		n += 8;
-				
-		/* Flush bytes. */
-		while (n >= WIDTH)
-		{
-			buffer_put(inbuf, (buf >> (n - WIDTH)) & ((1 << WIDTH) - 1));
-			n -= WIDTH;
-		}
+	for (int k = 0; k < shdict->nentries; k++)
+	{
+		dictionary_add(dict,
+			shdict->entries[k].parent + 1,
+			shdict->entries[k].ch,
+			first + k
+		);
 	}
-			
-	buffer_put(inbuf, EOF);
-	return NULL;
+
+	return (first - 1 + shdict->nentries);
 }
 
-/*============================================================================*
- *                                Readbyte                                    *
- *============================================================================*/
+/*
+ * Memory used by a dictionary trail.
+ */
+static size_t lzw_trail_footprint(void)
+{
+	return (sizeof(struct shdict) + ((1 << WIDTH) + 1)*sizeof(struct shdict_entry) + 2*64);
+}
 
 /*
- * Reads data from a file.
+ * Carves room for the strings of a dictionary from an arena.
  */
-static void* lzw_readbytes(void * arg)
+static shdict_t lzw_trail_create(arena_t arena)
 {
-	int ch;
+	shdict_t trail;
 
-	FILE *infile = (FILE *) arg;
+	trail = arena_alloc(arena, sizeof(struct shdict));
+	trail->id = 0;
+	trail->nentries = 0;
+	trail->entries = arena_alloc(arena, ((1 << WIDTH) + 1)*sizeof(struct shdict_entry));
 
-	/* Read data from file to the buffer. */
-	while ((ch = fgetc(infile)) != EOF)
-		buffer_put(inbuf, ch & 0xff);
-	
-	buffer_put(inbuf, EOF);
-	return NULL;
+	return (trail);
 }
 
-/*============================================================================*
- *                                writebytes                                  *
- *============================================================================*/
+/*
+ * Saves the strings of a dictionary, up to the last code given,
+ * into a trail, in the layout that lzw_init() primes dictionaries
+ * from.
+ */
+static shdict_t lzw_trail(shdict_t trail, dictionary_t dict, code_t first, code_t code)
+{
+	trail->nentries = code + 1 - first;
+
+	/* Codes always come after the codes of their parents. */
+	for (int i = 1; i < dict->nentries; i++)
+	{
+		const struct entry *en = &dict->entries[i];
+		code_t parent = dict->entries[en->parent].code;
+
+		if ((en->code < first) || (en->code > code))
+			continue;
+
+		trail->entries[en->code - first].parent =
+			(parent < RADIX) ? parent : RADIX + (parent - first);
+		trail->entries[en->code - first].ch = en->ch;
+	}
+
+	return (trail);
+}
 
 /*
- * Writes data to a file.
+ * Encoder.
  */
-static void* lzw_writebytes(void* arg)
+struct encoder
 {
-	int ch;
-	FILE* outfile = (FILE *) arg;
+	dictionary_t dict;              /* Dictionary.        */
+	shdict_t shdict;                /* Shared dictionary. */
+	code_t first;                   /* First free code.   */
+	code_t code;                    /* Last code given.   */
+	int i;                          /* Current prefix.    */
+	void (*emit)(void *, unsigned); /* Code sink.         */
+	void *arg;                      /* Sink argument.     */
+};
 
-	/* Read data from file to the buffer. */
-	while ((ch = buffer_get(outbuf)) != EOF)
-		fputc(ch, outfile);
+/*
+ * Restarts an encoder from an empty dictionary.
+ */
+static void encoder_restart(struct encoder *e)
+{
+	dictionary_reset(e->dict);
+	e->code = lzw_init(e->dict, RADIX, e->first, e->shdict);
+	e->i = 0;
+}
 
-	return NULL;
+/*
+ * Restarts an encoder from a saved dictionary.
+ */
+static void encoder_resume(struct encoder *e, shdict_t state)
+{
+	dictionary_reset(e->dict);
+	e->code = lzw_init(e->dict, RADIX, e->first, state);
+	e->i = 0;
 }
 
-/*============================================================================*
- *                                   LZW                                      *
- *============================================================================*/
+/*
+ * Initializes an encoder.
+ */
+static void encoder_init(
+	struct encoder *e,
+	struct lzw_session *s,
+	dictionary_t dict,
+	void (*emit)(void *, unsigned),
+	void *arg)
+{
+	e->dict = dict;
+	e->shdict = s->opts.dict;
+	e->first = s->first;
+	e->emit = emit;
+	e->arg = arg;
+
+	encoder_restart(e);
+}
 
 /*
- * Initializes dictionary.
+ * Emits the current prefix. Returns non-zero if
+ * the dictionary got full and was reset.
  */
-static code_t lzw_init(dictionary_t dict, int radix)
+static int encoder_emit(struct encoder *e)
 {
-	for (int i = 0; i < radix; i++)
-		dictionary_add(dict, 0, i, i);
-	
-	return (radix);
+	e->emit(e->arg, e->dict->entries[e->i].code);
+
+	if (e->code == ((1 << WIDTH) - 1))
+	{
+		dictionary_reset(e->dict);
+		e->code = lzw_init(e->dict, RADIX, e->first, e->shdict);
+		e->emit(e->arg, CODE_RESET);
+		return (1);
+	}
+
+	return (0);
 }
 
 /*
- * Compress data.
+ * Compress a character.
  */
-static void* lzw_compress(void* arg)
-{	
-	unsigned ch;       /* Working character. */
-	int i, ni;         /* Working entries.   */
-	code_t code;       /* Current code.      */
-	dictionary_t dict; /* Dictionary.        */
-	
-	dict = dictionary_create(1 << WIDTH);
-	
-	i = 0;
-	code = lzw_init(dict, RADIX);
+static void encoder_put(struct encoder *e, unsigned ch)
+{
+	int ni;
 
-	/* Compress data. */
-	ch = buffer_get(inbuf);
-	while (ch != EOF)
-	{	
-		ni = dictionary_find(dict, i, (char)ch);
-		
-		/* Find longest prefix. */
-		if (ni >= 0)
-		{			
-			ch = buffer_get(inbuf);
-			i = ni;
-		
-			/* Next character. */
-			if (ch != EOF)
-				continue;
-		}
-		
-		buffer_put(outbuf, dict->entries[i].code);
-		
-		if (code == ((1 << WIDTH) - 1))
-		{	
-			i = 0;
-			dictionary_reset(dict);
-			code = lzw_init(dict, RADIX);
-			buffer_put(outbuf, RADIX);
-			continue;
-		}
-		
-		dictionary_add(dict, i, ch, ++code);
-		i = 0;
+	ni = dictionary_find(e->dict, e->i, (char)ch);
+
+	/* Find longest prefix. */
+	if (ni >= 0)
+	{
+		e->i = ni;
+		return;
 	}
-	
-	buffer_put(outbuf, EOF);
 
-	dictionary_destroy(dict);
-	return NULL;
+	if (!encoder_emit(e))
+		dictionary_add(e->dict, e->i, ch, ++e->code);
+
+	e->i = dictionary_find(e->dict, 0, (char)ch);
 }
 
 /*
- * Builds a string.
+ * Sync flush: emit the pending prefix without extending
+ * it, so that the decoder can catch up.
  */
-static char *buildstr(char *base, char ch)
+static void encoder_flush(struct encoder *e)
 {
-	char *s, *p;
-	
-	p = s = smalloc((strlen(base) + 2)*sizeof(char));
-	
-	while (*base != '\0')
-		*p++ = *base++;
-	
-	*p++ = ch;
-	*p = '\0';
-	
-	return (s);
+	if (e->i == 0)
+		return;
+
+	e->emit(e->arg, e->dict->entries[e->i].code);
+	e->emit(e->arg, TOKEN_FLUSH);
+	e->i = 0;
 }
 
 /*
- * Decompress data.
+ * Emits whatever is pending at the end of input.
  */
-static void* lzw_decompress(void* arg)
+static void encoder_end(struct encoder *e)
 {
-	char *s, *p;   /* Working string. */
-	unsigned code; /* Working code.   */
-	unsigned i;    /* Loop index.     */
-	char **st;     /* String table.   */
-	
-	st = smalloc(((1 << WIDTH) + 2)*sizeof(char *));
-	
-	/* Initializes the symbol table. */
-	for (i = 0; i < RADIX; i++)
-		st[i] = buildstr("", i);
-	
-	st[i++] =  buildstr("", ' ');
-	
-	code = buffer_get(inbuf);
-	
-	/* Broken file. */
-	if (code >= i)
-		error("broken file");
-	
-	s = st[code];
-	
-	/* Decompress data. */
-	while (1)
+	if (e->i == 0)
+		return;
+
+	encoder_emit(e);
+	e->i = 0;
+}
+
+/*
+ * Emits a checksum. Segment checksums end the pending prefix
+ * the way a sync flush does, stream checksums end the input.
+ */
+static void encoder_check(struct encoder *e, unsigned token, unsigned crc)
+{
+	if (token == TOKEN_END)
+		encoder_end(e);
+	else if (e->i != 0)
 	{
-		/* Output current string. */
-		for (p = s; *p != '\0'; p++)
-			buffer_put(outbuf, (unsigned)(*p & 0xff));
-		
-		code = buffer_get(inbuf);
-		
-		/* End of input. */
-		if (code == EOF)
-			break;
-		
-		/* Reset symbol table. */
-		if (code == RADIX)
-		{			
-			while (i > 0)
-				free(st[--i]);
-			
-			/* Initializes the symbol table. */
-			for (i = 0; i < RADIX; i++)
-				st[i] = buildstr("", i);
-			
-			st[i++] =  buildstr("", ' ');
-			
-			code = buffer_get(inbuf);
-	
-			/* Broken file. */
-			if (code >= i)
-				error("broken file");
-			
-			s = st[code];
-			
-			continue;
-		}
-		
-		/* Broken file. */
-		if (code > i)
-			error("broken file");
-		
-		p = st[code];
-		
-		if (i == code)
-			p = buildstr(s, s[0]);
-		
-		st[i++] = buildstr(s, p[0]);
-		
-		s = p;
-	}
-	
-	buffer_put(outbuf, EOF);
-	
-	/* House keeping. */
-	while (i > 0)
-		free(st[--i]);
-	free(st);
+		e->emit(e->arg, e->dict->entries[e->i].code);
+		e->i = 0;
+	}
 
-	return NULL;
+	e->emit(e->arg, token);
+	for (int k = 24; k >= 0; k -= 8)
+		e->emit(e->arg, (crc >> k) & 0xff);
 }
 
 /*
- * Compress/Decompress a file using the LZW algorithm. 
+ * Emits a chunk reference, given as six bytes of distance and
+ * length. The pending prefix ends the way a sync flush does.
  */
-void lzw(FILE *input, FILE *output, int compress)
+static void encoder_ref(struct encoder *e, const unsigned char *ref)
 {
-	inbuf = buffer_create(5096);
-	outbuf = buffer_create(5096);
+	if (e->i != 0)
+	{
+		e->emit(e->arg, e->dict->entries[e->i].code);
+		e->i = 0;
+	}
 
-	pthread_t reader;
-	pthread_t worker;
-	pthread_t writer;
+	e->emit(e->arg, TOKEN_REF);
+	for (int k = 0; k < 6; k++)
+		e->emit(e->arg, ref[k]);
+}
 
-	/* Compress mode. */
-	if (compress)
+/*
+ * Storer. Compresses input one window at a time and stores
+ * windows that would not shrink as raw bytes instead.
+ *
+ * Codes are held back until the window they belong to is
+ * done. A stored window restarts the dictionary on both
+ * ends, since the decoder never sees the codes that were
+ * dropped. After a window is stored, only a prefix of
+ * the next ones is tried, for a number of windows that
+ * doubles while data stays incompressible. Windows whose
+ * prefix shrinks are tried in full again.
+ */
+struct storer
+{
+	struct encoder *e;              /* Encoder.                    */
+	unsigned char *win;             /* Input window.               */
+	size_t nwin;                    /* Bytes in window.            */
+	unsigned *codes;                /* Codes held back.            */
+	size_t ncodes;                  /* Number of codes held back.  */
+	int i0;                         /* Prefix pending at start.    */
+	code_t c0;                      /* Code of that prefix.        */
+	unsigned skip;                  /* Windows only probed.        */
+	unsigned backoff;               /* Last number of skips.       */
+	void (*emit)(void *, unsigned); /* Code sink.                  */
+	void *arg;                      /* Sink argument.              */
+};
+
+/*
+ * Memory used by a storer.
+ */
+static size_t storer_footprint(void)
+{
+	return (STORE_WINDOW + (STORE_WINDOW + 16)*sizeof(unsigned) + 2*64);
+}
+
+/*
+ * Holds back a code.
+ */
+static void storer_hold(void *arg, unsigned code)
+{
+	struct storer *st = arg;
+
+	st->codes[st->ncodes++] = code;
+}
+
+/*
+ * Hands held back codes to the sink.
+ */
+static void storer_release(struct storer *st)
+{
+	for (size_t k = 0; k < st->ncodes; k++)
+		st->emit(st->arg, st->codes[k]);
+
+	st->ncodes = 0;
+}
+
+/*
+ * Starts a new stream. The encoder must have been
+ * initialized with storer_hold() as its sink.
+ */
+static void storer_reset(struct storer *st)
+{
+	st->nwin = 0;
+	st->ncodes = 0;
+	st->i0 = 0;
+	st->c0 = 0;
+	st->skip = 0;
+	st->backoff = 0;
+}
+
+/*
+ * Initializes a storer.
+ */
+static void storer_init(
+	struct storer *st,
+	struct lzw_session *s,
+	struct encoder *e,
+	void (*emit)(void *, unsigned),
+	void *arg)
+{
+	st->e = e;
+	st->win = arena_alloc(s->arena, STORE_WINDOW);
+	st->codes = arena_alloc(s->arena, (STORE_WINDOW + 16)*sizeof(unsigned));
+	st->emit = emit;
+	st->arg = arg;
+
+	storer_reset(st);
+}
+
+/*
+ * Ends the current window, either compressed or stored.
+ */
+static void storer_window(struct storer *st)
+{
+	if (st->nwin == 0)
+		return;
+
+	/* Compressed. */
+	if ((st->skip == 0) &&
+		(st->ncodes*WIDTH <= 8*(st->nwin + STORE_OVERHEAD)))
 	{
-		pthread_create(&reader, NULL, lzw_readbytes, (void *)input);
-		pthread_create(&worker, NULL, lzw_compress, NULL);
-		pthread_create(&writer, NULL, lzw_writebits, (void *)output);
+		storer_release(st);
+		st->backoff = 0;
 	}
-	
-	/* Decompress mode. */
+
+	/* Stored. */
 	else
-	{	
-		pthread_create(&reader, NULL, lzw_readbits, (void *)input);
-		pthread_create(&worker, NULL, lzw_decompress, NULL);
-		pthread_create(&writer, NULL, lzw_writebytes, (void *)output);
+	{
+		if (st->skip > 0)
+			st->skip--;
+		else
+		{
+			st->backoff = (st->backoff == 0) ? 1 : 2*st->backoff;
+			if (st->backoff > STORE_BACKOFF)
+				st->backoff = STORE_BACKOFF;
+			st->skip = st->backoff;
+		}
+
+		/* Prefix that started in the previous window. */
+		if (st->i0 != 0)
+			st->emit(st->arg, st->c0);
+
+		st->emit(st->arg, TOKEN_STORE | st->nwin);
+		for (size_t k = 0; k < st->nwin; k++)
+			st->emit(st->arg, st->win[k]);
+
+		st->ncodes = 0;
+		encoder_restart(st->e);
 	}
-	
-	pthread_join(reader, NULL);
-	pthread_join(worker, NULL);
-	pthread_join(writer, NULL);
 
-	buffer_destroy(outbuf);
-	buffer_destroy(inbuf);
+	st->nwin = 0;
+	st->i0 = st->e->i;
+	st->c0 = st->e->dict->entries[st->e->i].code;
+}
+
+/*
+ * Compress a character.
+ */
+static void storer_put(struct storer *st, unsigned ch)
+{
+	st->win[st->nwin++] = ch;
+
+	if ((st->skip == 0) || (st->nwin <= STORE_PROBE))
+		encoder_put(st->e, ch);
+
+	/* Probe shrinks, try the whole window. */
+	if ((st->skip > 0) && (st->nwin == STORE_PROBE) &&
+		(st->ncodes*WIDTH <= 8*st->nwin))
+		st->skip = 0;
+
+	if (st->nwin == STORE_WINDOW)
+		storer_window(st);
+}
+
+/*
+ * Sync flush.
+ */
+static void storer_flush(struct storer *st)
+{
+	storer_window(st);
+
+	if (st->e->i != 0)
+	{
+		encoder_flush(st->e);
+		storer_release(st);
+	}
+	else
+		st->emit(st->arg, TOKEN_FLUSH);
+
+	st->i0 = 0;
+}
+
+/*
+ * Emits whatever is pending at the end of input.
+ */
+static void storer_end(struct storer *st)
+{
+	storer_window(st);
+	encoder_end(st->e);
+	storer_release(st);
+}
+
+/*
+ * Emits a checksum.
+ */
+static void storer_check(struct storer *st, unsigned token, unsigned crc)
+{
+	storer_window(st);
+	encoder_check(st->e, token, crc);
+	storer_release(st);
+
+	st->i0 = 0;
+}
+
+/*
+ * Emits a chunk reference.
+ */
+static void storer_ref(struct storer *st, const unsigned char *ref)
+{
+	storer_window(st);
+	encoder_ref(st->e, ref);
+	storer_release(st);
+
+	st->i0 = 0;
+}
+
+/*
+ * Decoder.
+ */
+struct decoder
+{
+	struct strtab st; /* String table.      */
+	shdict_t shdict;  /* Shared dictionary. */
+	code_t first;     /* First free code.   */
+	unsigned i;       /* Next code.         */
+	unsigned prev;    /* Previous code.     */
+
+	/* String sink. */
+	void (*emit)(void *, const unsigned char *, size_t);
+	void *arg;
+};
+
+/*
+ * Memory used by a decoder.
+ */
+static size_t decoder_footprint(void)
+{
+	return (((1 << WIDTH) + 2)*(sizeof(int) + 1) + (1 << WIDTH) + 3*64);
+}
+
+/*
+ * Resets a decoder to the start of a stream.
+ */
+static void decoder_reset(struct decoder *d)
+{
+	d->i = strtab_init(&d->st, RADIX, d->first, d->shdict);
+	d->prev = EOF;
+}
+
+/*
+ * Resets a decoder to a saved dictionary.
+ */
+static void decoder_resume(struct decoder *d, shdict_t state)
+{
+	d->i = strtab_init(&d->st, RADIX, d->first, state);
+	d->prev = EOF;
+}
+
+/*
+ * Initializes a decoder.
+ */
+static void decoder_init(
+	struct decoder *d,
+	struct lzw_session *s,
+	void (*emit)(void *, const unsigned char *, size_t),
+	void *arg)
+{
+	d->st.parent = arena_alloc(s->arena, ((1 << WIDTH) + 2)*sizeof(int));
+	d->st.ch = arena_alloc(s->arena, ((1 << WIDTH) + 2)*sizeof(unsigned char));
+	d->st.buf = arena_alloc(s->arena, (1 << WIDTH)*sizeof(unsigned char));
+	d->shdict = s->opts.dict;
+	d->first = s->first;
+	d->emit = emit;
+	d->arg = arg;
+
+	decoder_reset(d);
+}
+
+/*
+ * Decompress a code.
+ */
+static void decoder_put(struct decoder *d, unsigned code)
+{
+	unsigned j;
+
+	/* Reset symbol table. */
+	if ((code == CODE_RESET) || STORED(code))
+	{
+		decoder_reset(d);
+		return;
+	}
+
+	/*
+	 * Sync flush, checksum or reference: start
+	 * over without linking across the boundary.
+	 */
+	if ((code == TOKEN_FLUSH) || CHECKED(code) || (code == TOKEN_REF))
+	{
+		d->prev = EOF;
+		return;
+	}
+
+	/* Broken file. */
+	if ((code >= RADIX) && (code < d->first))
+		error("broken file");
+
+	/* First code. */
+	if (d->prev == EOF)
+	{
+		/* Broken file. */
+		if (code >= d->i)
+			error("broken file");
+
+		j = strtab_expand(&d->st, code);
+	}
+
+	else
+	{
+		/* Broken file. */
+		if ((code > d->i) || (d->i > (1 << WIDTH)))
+			error("broken file");
+
+		/*
+		 * Add previous string plus first character of the
+		 * current one, which is known in advance when the
+		 * current code is the one being defined.
+		 */
+		d->st.parent[d->i] = d->prev;
+		if (code == d->i)
+		{
+			d->st.ch[d->i++] = d->st.buf[strtab_expand(&d->st, d->prev)];
+			j = strtab_expand(&d->st, code);
+		}
+		else
+		{
+			j = strtab_expand(&d->st, code);
+			d->st.ch[d->i++] = d->st.buf[j];
+		}
+	}
+
+	/* Output current string. */
+	d->emit(d->arg, &d->st.buf[j], (1 << WIDTH) - j);
+
+	d->prev = code;
+}
+
+/*
+ * Outputs the data of a stored segment.
+ */
+static void decoder_raw(struct decoder *d, const unsigned char *data, size_t n)
+{
+	d->emit(d->arg, data, n);
+}
+
+/*============================================================================*
+ *                                Stream Header                               *
+ *============================================================================*/
+
+/*
+ * Stream header.
+ *
+ * Streams that use no optional feature have no header, so that they
+ * stay byte-compatible with older releases. Their first byte holds the
+ * top bits of a literal code and therefore is always below 0x10, which
+ * never clashes with the header magic.
+ *
+ * Appended archives are a sequence of members, each one with its own
+ * header and ending with a stream checksum. A member may continue the
+ * dictionary that the previous one left behind.
+ *
+ * The top bit of the flags byte says that a second flags byte follows,
+ * for the flags above the first eight. It is only written when one of
+ * them is set, so that the extension does not cost streams anything.
+ */
+#define HEADER_MAGIC0   'L'    /* First magic byte.          */
+#define HEADER_MAGIC1   'Z'    /* Second magic byte.         */
+#define HEADER_SHDICT   0x01   /* Shared dictionary used.    */
+#define HEADER_SYNC     0x02   /* Sync flushes enabled.      */
+#define HEADER_BLOCKS   0x04   /* Independent blocks.        */
+#define HEADER_STORED   0x08   /* Stored segments.           */
+#define HEADER_CRC      0x10   /* Checksums.                 */
+#define HEADER_MEMBER   0x20   /* Appendable member.         */
+#define HEADER_CONTINUE 0x40   /* Continues last dictionary. */
+#define HEADER_EXTEND   0x80   /* Second flags byte follows. */
+#define HEADER_DEDUP    0x100  /* Chunk references.          */
+#define HEADER_ENTROPY  0x200  /* Entropy coded.             */
+#define HEADER_FLAGS    (HEADER_SHDICT | HEADER_SYNC | HEADER_BLOCKS | \
+                         HEADER_STORED | HEADER_CRC | HEADER_MEMBER | \
+                         HEADER_CONTINUE | HEADER_DEDUP | HEADER_ENTROPY)
+
+/*
+ * Asserts if sync flushes are enabled.
+ */
+static int lzw_sync(const struct lzw_options *opts)
+{
+	return (opts->sync || (opts->flush_bytes > 0) || (opts->flush_idle > 0));
+}
+
+/*
+ * Asserts if a session runs on a thread pool.
+ */
+static int lzw_pooled(const struct lzw_options *opts)
+{
+	return (opts->pool != NULL);
+}
+
+/*
+ * Returns the header flags of a stream, plus some extra flags.
+ * Checkpoints outside pool mode are taken at sync flushes.
+ */
+static int lzw_flags(const struct lzw_options *opts, int extra)
+{
+	int flags = extra;
+
+	if (opts->dict != NULL)
+		flags |= HEADER_SHDICT;
+	if (lzw_sync(opts) || ((opts->checkpoint > 0) && (!lzw_pooled(opts))))
+		flags |= HEADER_SYNC;
+	if (lzw_pooled(opts))
+		flags |= HEADER_BLOCKS;
+	if (opts->store)
+		flags |= HEADER_STORED;
+	if (opts->crc)
+		flags |= HEADER_CRC;
+	if (opts->dedup)
+		flags |= HEADER_DEDUP;
+	if (opts->entropy)
+		flags |= HEADER_ENTROPY;
+
+	return (flags);
+}
+
+/*
+ * Writes the stream header.
+ */
+static void lzw_writeheader(FILE *out, const struct lzw_options *opts, int flags)
+{
+	/* No header needed. */
+	if (flags == 0)
+		return;
+
+	fputc(HEADER_MAGIC0, out);
+	fputc(HEADER_MAGIC1, out);
+	fputc((flags & 0xff) | ((flags & ~0xff) ? HEADER_EXTEND : 0), out);
+	if (flags & ~0xff)
+		fputc((flags >> 8) & 0xff, out);
+
+	if (flags & HEADER_SHDICT)
+	{
+		for (int k = 24; k >= 0; k -= 8)
+			fputc((opts->dict->id >> k) & 0xff, out);
+	}
+}
+
+/*
+ * Reads the stream header.
+ */
+static int lzw_readheader(FILE *in, const struct lzw_options *opts)
+{
+	int ch;
+	int flags;
+	unsigned id;
+
+	ch = fgetc(in);
+
+	/* Headerless stream. */
+	if ((ch == EOF) || (ch < 0x10))
+	{
+		ungetc(ch, in);
+		if (opts->dict != NULL)
+			error("stream does not use a shared dictionary");
+		return (0);
+	}
+
+	/* Bad magic. */
+	if (ch != HEADER_MAGIC0)
+		error("broken file");
+	if (fgetc(in) != HEADER_MAGIC1)
+		error("broken file");
+
+	flags = fgetc(in);
+
+	/* Extended flags. */
+	if ((flags != EOF) && (flags & HEADER_EXTEND))
+	{
+		if ((ch = fgetc(in)) == EOF)
+			error("broken file");
+		flags = (flags & ~HEADER_EXTEND) | (ch << 8);
+
+		/* Only written when needed. */
+		if (ch == 0)
+			error("broken file");
+	}
+
+	/* Unknown features. */
+	if ((flags == EOF) || (flags == 0) || (flags & ~HEADER_FLAGS))
+		error("unsupported stream");
+
+	if (flags & HEADER_SHDICT)
+	{
+		id = 0;
+		for (int k = 0; k < 4; k++)
+			id = (id << 8) | (fgetc(in) & 0xff);
+
+		if (opts->dict == NULL)
+			error("stream requires a shared dictionary");
+		if (opts->dict->id != id)
+			error("shared dictionary mismatch");
+	}
+
+	else if (opts->dict != NULL)
+		error("stream does not use a shared dictionary");
+
+	return (flags);
+}
+
+/*
+ * Reads the header of the next member of an archive, once
+ * the current one has ended. Returns zero at end of input.
+ */
+static int lzw_readmember(FILE *in, const struct lzw_options *opts)
+{
+	int ch;
+	int flags;
+
+	if ((ch = fgetc(in)) == EOF)
+		return (0);
+	ungetc(ch, in);
+
+	flags = lzw_readheader(in, opts);
+
+	/* Trailing garbage. */
+	if (!(flags & HEADER_MEMBER))
+		error("broken file");
+
+	return (flags);
+}
+
+/*============================================================================*
+ *                                 Checksums                                  *
+ *============================================================================*/
+
+/*
+ * Running CRC-32C of uncompressed data.
+ */
+struct checksum
+{
+	unsigned seg;   /* Checksum of current segment.   */
+	size_t len;     /* Length of current segment.     */
+	unsigned total; /* Checksum of previous segments. */
+};
+
+/*
+ * Initializes a running checksum.
+ */
+static void checksum_init(struct checksum *cs)
+{
+	cs->seg = 0;
+	cs->len = 0;
+	cs->total = 0;
+}
+
+/*
+ * Sums up data.
+ */
+static void checksum_update(struct checksum *cs, const unsigned char *data, size_t n)
+{
+	cs->seg = crc32c(cs->seg, data, n);
+	cs->len += n;
+}
+
+/*
+ * Ends the current segment. Returns its checksum.
+ */
+static unsigned checksum_segment(struct checksum *cs)
+{
+	unsigned crc = cs->seg;
+
+	cs->total = crc32c_combine(cs->total, cs->seg, cs->len);
+	cs->seg = 0;
+	cs->len = 0;
+
+	return (crc);
+}
+
+/*
+ * Checks a segment or stream checksum read from a stream.
+ */
+static void checksum_check(struct checksum *cs, unsigned token, unsigned crc)
+{
+	unsigned expected = checksum_segment(cs);
+
+	if (token == TOKEN_END)
+		expected = cs->total;
+
+	if (expected != crc)
+		error("checksum mismatch");
+}
+
+/*============================================================================*
+ *                                Checkpoints                                 *
+ *============================================================================*/
+
+/*
+ * Magic of checkpoint files.
+ */
+#define CHECKPOINT_MAGIC "LZK1"
+
+/*
+ * Checkpoint of a compression: a point where the output ends at a
+ * byte boundary, along with everything needed to carry on from it.
+ */
+struct checkpoint
+{
+	uint64_t interval;  /* Checkpoint interval.             */
+	uint64_t input;     /* Input offset.                    */
+	uint64_t output;    /* Output offset.                   */
+	struct checksum cs; /* Input summary.                   */
+	shdict_t dict;      /* Dictionary (empty in pool mode). */
+};
+
+/*
+ * Reads a big-endian integer from a file.
+ */
+static uint64_t lzw_getint(FILE *file, int nbytes)
+{
+	uint64_t x = 0;
+
+	while (nbytes-- > 0)
+		x = (x << 8) | (fgetc(file) & 0xff);
+
+	return (x);
+}
+
+/*
+ * Writes a big-endian integer to a file.
+ */
+static void lzw_putint(FILE *file, uint64_t x, int nbytes)
+{
+	while (nbytes-- > 0)
+		fputc((x >> (8*nbytes)) & 0xff, file);
+}
+
+/*
+ * Loads a checkpoint. Returns NULL if there is none.
+ */
+static struct checkpoint *lzw_loadcheckpoint(const char *filename)
+{
+	FILE *file;
+	char magic[4];
+	struct checkpoint *ck;
+
+	if ((file = fopen(filename, "rb")) == NULL)
+		return (NULL);
+
+	/* Bad magic. */
+	if ((fread(magic, 1, 4, file) != 4) || (memcmp(magic, CHECKPOINT_MAGIC, 4)))
+		error("bad checkpoint file");
+
+	ck = smalloc(sizeof(struct checkpoint));
+	ck->interval = lzw_getint(file, 8);
+	ck->input = lzw_getint(file, 8);
+	ck->output = lzw_getint(file, 8);
+	ck->cs.seg = lzw_getint(file, 4);
+	ck->cs.len = lzw_getint(file, 8);
+	ck->cs.total = lzw_getint(file, 4);
+	ck->dict = shdict_read(file);
+
+	fclose(file);
+
+	return (ck);
+}
+
+/*
+ * Saves a checkpoint. The file is replaced at once, so that a
+ * crash leaves either the previous checkpoint or this one.
+ */
+static void lzw_savecheckpoint(const char *filename, const struct checkpoint *ck)
+{
+	FILE *file;
+	char *tmp;
+
+	tmp = smalloc(strlen(filename) + sizeof(".tmp"));
+	strcpy(tmp, filename);
+	strcat(tmp, ".tmp");
+
+	file = fopen(tmp, "wb");
+	if (file == NULL)
+		error("cannot open checkpoint file");
+
+	fwrite(CHECKPOINT_MAGIC, 1, 4, file);
+	lzw_putint(file, ck->interval, 8);
+	lzw_putint(file, ck->input, 8);
+	lzw_putint(file, ck->output, 8);
+	lzw_putint(file, ck->cs.seg, 4);
+	lzw_putint(file, ck->cs.len, 8);
+	lzw_putint(file, ck->cs.total, 4);
+	shdict_write(ck->dict, file);
+
+	if ((fflush(file) != 0) || (fsync(fileno(file)) != 0) ||
+		(fclose(file) != 0) || (rename(tmp, filename) != 0))
+		error("cannot write checkpoint file");
+
+	free(tmp);
+}
+
+/*
+ * Makes output durable and saves a checkpoint at its end.
+ */
+static void lzw_checkpoint(struct lzw_session *s, struct checkpoint *ck)
+{
+	if ((fflush(s->output) != 0) || (fsync(fileno(s->output)) != 0))
+		error("cannot write output file");
+
+	ck->interval = s->interval;
+	ck->output = ftell(s->output);
+	lzw_savecheckpoint(s->opts.ckpt, ck);
+}
+
+/*
+ * Picks up an interrupted compression at its last checkpoint: cuts
+ * the output there and skips the input that it covers. Returns the
+ * stream flags, or -1 if there is nothing to resume.
+ */
+static int lzw_resume(struct lzw_session *s)
+{
+	struct lzw_options opts;
+	struct checkpoint *ck;
+	long size;
+	int flags;
+
+	ck = lzw_loadcheckpoint(s->opts.ckpt);
+
+	/* Start over. */
+	if (ck == NULL)
+	{
+		warning("no checkpoint, starting over");
+		if (ftruncate(fileno(s->output), 0) != 0)
+			error("cannot truncate output file");
+		rewind(s->output);
+		return (-1);
+	}
+
+	if (s->interval == 0)
+		s->interval = ck->interval;
+
+	size = (fseek(s->output, 0, SEEK_END) == 0) ? ftell(s->output) : -1;
+	if ((size < 0) || ((uint64_t) size < ck->output))
+		error("checkpoint does not match output file");
+
+	rewind(s->output);
+	opts = s->opts;
+	opts.checkpoint = s->interval;
+	flags = lzw_readheader(s->output, &opts);
+	if (flags != lzw_flags(&opts, 0))
+		error("checkpoint does not match options");
+
+	if ((ftruncate(fileno(s->output), ck->output) != 0) ||
+		(fseek(s->output, ck->output, SEEK_SET) != 0))
+		error("cannot truncate output file");
+	if (fseek(s->input, ck->input, SEEK_SET) != 0)
+		error("cannot seek input file");
+
+	s->ckpt = ck;
+	s->offset = ck->input;
+
+	/* Blocks start from scratch anyway. */
+	if (lzw_pooled(&s->opts))
+		shdict_destroy(ck->dict);
+	else
+		s->resume = ck->dict;
+	ck->dict = NULL;
+
+	return (flags);
+}
+
+/*
+ * Ends a compression with checkpoints, which need not be
+ * resumed anymore.
+ */
+static void lzw_checkpoint_end(struct lzw_session *s)
+{
+	remove(s->opts.ckpt);
+
+	if (s->ckpt != NULL)
+	{
+		free(s->ckpt);
+		s->ckpt = NULL;
+	}
+
+	if (s->resume != NULL)
+	{
+		shdict_destroy(s->resume);
+		s->resume = NULL;
+	}
+}
+
+/*============================================================================*
+ *                                  Pipeline                                  *
+ *============================================================================*/
+
+/*
+ * Writes bytes to the output file.
+ */
+static void lzw_write(FILE *out, const unsigned char *data, size_t n)
+{
+	if (fwrite(data, 1, n, out) != n)
+		error("cannot write output file");
+}
+
+/*
+ * Pushes written bytes out of the output stream.
+ */
+static void lzw_flush(FILE *out)
+{
+	if (fflush(out) != 0)
+		error("cannot write output file");
+}
+
+/*
+ * Gets a big-endian integer passed along as bytes in a buffer.
+ */
+static uint64_t lzw_get_int(buffer_t buf, int nbytes)
+{
+	uint64_t x = 0;
+
+	while (nbytes-- > 0)
+		x = (x << 8) | buffer_get(buf);
+
+	return (x);
+}
+
+/*
+ * Takes a checkpoint handed over by the compressor, once
+ * everything before it is out. The dictionary goes into
+ * a trail that the writer keeps for all checkpoints.
+ */
+static void lzw_writemark(struct lzw_session *s, shdict_t dict)
+{
+	struct checkpoint ck;
+
+	ck.input = lzw_get_int(s->outbuf, 8);
+	ck.cs.seg = lzw_get_int(s->outbuf, 4);
+	ck.cs.len = lzw_get_int(s->outbuf, 8);
+	ck.cs.total = lzw_get_int(s->outbuf, 4);
+
+	/* Dictionary. */
+	ck.dict = dict;
+	ck.dict->nentries = lzw_get_int(s->outbuf, 2);
+	for (int k = 0; k < ck.dict->nentries; k++)
+	{
+		ck.dict->entries[k].parent = lzw_get_int(s->outbuf, 2);
+		ck.dict->entries[k].ch = lzw_get_int(s->outbuf, 1);
+	}
+
+	lzw_checkpoint(s, &ck);
+}
+
+/*
+ * Hands written bytes to the verifier, if any.
+ */
+static void lzw_tee(struct lzw_session *s, const unsigned char *data, size_t n)
+{
+	if (s->chkbuf == NULL)
+		return;
+
+	for (size_t k = 0; k < n; k++)
+		buffer_put(s->chkbuf, data[k]);
+}
+
+/*
+ * Writes data to a file.
+ */
+static void* lzw_writebits(void* arg)
+{
+	unsigned code;                   /* Working code.          */
+	unsigned char data[WRITE_CHUNK]; /* Staged bytes.          */
+	struct bitwriter bw;             /* Bit writer.            */
+	size_t teed;                     /* Bytes teed.            */
+	shdict_t dict;                   /* Checkpoint dictionary. */
+
+	struct lzw_session *s = arg;
+	FILE *out = s->output;
+
+	affinity_apply(s->affinity, AFFINITY_WRITER);
+
+	bitwriter_init(&bw, data);
+	teed = 0;
+	dict = (s->interval > 0) ? lzw_trail_create(s->arena) : NULL;
+
+	/*
+	 * Read data from input buffer
+	 * and write to output file.
+	 */
+	while ((code = buffer_get(s->outbuf)) != EOF)
+	{
+		/* Checkpoint, output ends at a sync flush. */
+		if (code == TOKEN_MARK)
+		{
+			lzw_write(out, data, bw.len);
+			bw.len = teed = 0;
+			lzw_writemark(s, dict);
+			continue;
+		}
+
+		/* Fixed width codes need no cuts. */
+		if (code == TOKEN_CUT)
+			continue;
+
+		bitwriter_put(&bw, code);
+
+		/* Verify bytes as soon as they are packed. */
+		lzw_tee(s, &data[teed], bw.len - teed);
+		teed = bw.len;
+
+		/* Push out everything so far. */
+		if ((code == TOKEN_FLUSH) || (bw.len > WRITE_CHUNK - 5))
+		{
+			lzw_write(out, data, bw.len);
+			bw.len = teed = 0;
+
+			if (code == TOKEN_FLUSH)
+				lzw_flush(out);
+		}
+	}
+
+	bitwriter_align(&bw);
+	lzw_tee(s, &data[teed], bw.len - teed);
+	lzw_write(out, data, bw.len);
+
+	if (s->chkbuf != NULL)
+		buffer_put(s->chkbuf, EOF);
+
+	return NULL;
+}
+
+/*
+ * Writes entropy coded data to a file.
+ */
+static void* lzw_writesymbols(void* arg)
+{
+	unsigned code;    /* Working code.          */
+	struct packer pk; /* Packer.                */
+	shdict_t dict;    /* Checkpoint dictionary. */
+
+	struct lzw_session *s = arg;
+	FILE *out = s->output;
+
+	affinity_apply(s->affinity, AFFINITY_WRITER);
+
+	packer_init(&pk, s->arena, arena_alloc(s->arena, packer_room()));
+	dict = (s->interval > 0) ? lzw_trail_create(s->arena) : NULL;
+
+	while ((code = buffer_get(s->outbuf)) != EOF)
+	{
+		/* Checkpoint, blocks end at the sync flush before. */
+		if (code == TOKEN_MARK)
+		{
+			lzw_writemark(s, dict);
+			continue;
+		}
+
+		/* Cut for the verifier. */
+		if (code == TOKEN_CUT)
+		{
+			if ((pk.ncodes > 0) && (pk.pending == 0))
+				packer_block(&pk);
+		}
+		else
+			packer_put(&pk, code);
+
+		/* Push out blocks as they are done. */
+		if (pk.len > 0)
+		{
+			lzw_tee(s, pk.out, pk.len);
+			lzw_write(out, pk.out, pk.len);
+			pk.len = 0;
+
+			if (code == TOKEN_FLUSH)
+				lzw_flush(out);
+		}
+	}
+
+	packer_end(&pk);
+	lzw_tee(s, pk.out, pk.len);
+	lzw_write(out, pk.out, pk.len);
+
+	if (s->chkbuf != NULL)
+		buffer_put(s->chkbuf, EOF);
+
+	return NULL;
+}
+
+/*
+ * Reads data from a file.
+ */
+static void* lzw_readbits(void* arg)
+{
+	int ch;               /* Working byte.   */
+	unsigned code;        /* Working code.   */
+	struct bitreader br;  /* Bit reader.     */
+	int ended;            /* Stream ended?   */
+
+	struct lzw_session *s = arg;
+	FILE *in = s->input;
+
+	affinity_apply(s->affinity, AFFINITY_READER);
+
+	bitreader_init(&br, s->control);
+	ended = 0;
+
+	/*
+	 * Read data from input file
+	 * and write to output buffer.
+	 */
+	while ((ch = fgetc(in)) != EOF)
+	{
+		if ((code = bitreader_put(&br, ch)) == TOKEN_NONE)
+			continue;
+
+		buffer_put(s->inbuf, code);
+
+		/* Copy stored segment. */
+		if (STORED(code))
+		{
+			for (unsigned k = code & 0xffff; k > 0; k--)
+			{
+				if ((ch = fgetc(in)) == EOF)
+					error("broken file");
+				buffer_put(s->inbuf, ch);
+			}
+		}
+
+		/* Pass reference on. */
+		else if (code == TOKEN_REF)
+		{
+			for (int k = 24; k >= 0; k -= 8)
+				buffer_put(s->inbuf, (br.word >> k) & 0xff);
+			for (int k = 0; k < 2; k++)
+			{
+				if ((ch = fgetc(in)) == EOF)
+					error("broken file");
+				buffer_put(s->inbuf, ch);
+			}
+		}
+
+		/* Pass checksum on. */
+		else if (CHECKED(code))
+		{
+			for (int k = 24; k >= 0; k -= 8)
+				buffer_put(s->inbuf, (br.word >> k) & 0xff);
+
+			/* End of member. */
+			if (code == TOKEN_END)
+			{
+				int flags = lzw_readmember(in, &s->opts);
+
+				/* End of stream. */
+				if (flags == 0)
+				{
+					ended = 1;
+					break;
+				}
+
+				/* Members are all entropy coded, or none is. */
+				if (flags & HEADER_ENTROPY)
+					error("broken file");
+
+				if (!(flags & HEADER_CONTINUE))
+					buffer_put(s->inbuf, CODE_RESET);
+				bitreader_init(&br, s->control);
+			}
+		}
+	}
+
+	/* Missing stream checksum. */
+	if ((s->crc) && (!ended))
+		error("truncated file");
+
+	buffer_put(s->inbuf, EOF);
+	return NULL;
+}
+
+/*
+ * Reads entropy coded data from a file.
+ */
+static void* lzw_readsymbols(void* arg)
+{
+	unsigned code;      /* Working code.  */
+	struct unpacker u;  /* Unpacker.      */
+	int ended;          /* Stream ended?  */
+
+	struct lzw_session *s = arg;
+
+	affinity_apply(s->affinity, AFFINITY_READER);
+
+	unpacker_init(&u, s->input, NULL);
+	ended = 0;
+
+	while ((code = unpacker_get(&u)) != EOF)
+	{
+		buffer_put(s->inbuf, code);
+
+		/* Copy stored segment. */
+		if (STORED(code))
+		{
+			for (unsigned k = code & 0xffff; k > 0; k--)
+				buffer_put(s->inbuf, unpacker_byte(&u));
+		}
+
+		/* Pass reference on. */
+		else if (code == TOKEN_REF)
+		{
+			for (int k = 24; k >= 0; k -= 8)
+				buffer_put(s->inbuf, (u.word >> k) & 0xff);
+			for (int k = 0; k < 2; k++)
+				buffer_put(s->inbuf, unpacker_byte(&u));
+		}
+
+		/* Pass checksum on. */
+		else if (CHECKED(code))
+		{
+			for (int k = 24; k >= 0; k -= 8)
+				buffer_put(s->inbuf, (u.word >> k) & 0xff);
+
+			/* End of member. */
+			if (code == TOKEN_END)
+			{
+				int flags = lzw_readmember(s->input, &s->opts);
+
+				/* End of stream. */
+				if (flags == 0)
+				{
+					ended = 1;
+					break;
+				}
+
+				/* Members are all entropy coded, or none is. */
+				if (!(flags & HEADER_ENTROPY))
+					error("broken file");
+
+				if (!(flags & HEADER_CONTINUE))
+					buffer_put(s->inbuf, CODE_RESET);
+				unpacker_init(&u, s->input, NULL);
+			}
+		}
+	}
+
+	/* Missing stream checksum. */
+	if ((s->crc) && (!ended))
+		error("truncated file");
+
+	buffer_put(s->inbuf, EOF);
+	return NULL;
+}
+
+/*
+ * Hands an input byte to the compressor and, in
+ * verify mode, to the verifier.
+ */
+static void lzw_put_byte(struct lzw_session *s, unsigned ch)
+{
+	if (s->refbuf != NULL)
+		buffer_put(s->refbuf, ch);
+
+	buffer_put(s->inbuf, ch);
+}
+
+/*
+ * Hands a checksum to the compressor.
+ */
+static void lzw_put_check(struct lzw_session *s, unsigned token, unsigned crc)
+{
+	buffer_put(s->inbuf, token);
+	for (int k = 24; k >= 0; k -= 8)
+		buffer_put(s->inbuf, (crc >> k) & 0xff);
+}
+
+/*
+ * Hands a checkpoint request to the compressor.
+ */
+static void lzw_put_mark(struct lzw_session *s, const struct checksum *cs)
+{
+	buffer_put(s->inbuf, TOKEN_MARK);
+	for (int k = 56; k >= 0; k -= 8)
+		buffer_put(s->inbuf, (s->offset >> k) & 0xff);
+	for (int k = 24; k >= 0; k -= 8)
+		buffer_put(s->inbuf, (cs->seg >> k) & 0xff);
+	for (int k = 56; k >= 0; k -= 8)
+		buffer_put(s->inbuf, ((uint64_t) cs->len >> k) & 0xff);
+	for (int k = 24; k >= 0; k -= 8)
+		buffer_put(s->inbuf, (cs->total >> k) & 0xff);
+
+	s->mark = s->offset + s->interval;
+}
+
+/*
+ * Ends a checksummed segment or takes a checkpoint,
+ * if input got to either.
+ */
+static void lzw_put_marks(struct lzw_session *s, struct checksum *cs)
+{
+	/* End of segment. */
+	if ((s->opts.crc) && (cs->len == CRC_SEGMENT))
+		lzw_put_check(s, TOKEN_CRC, checksum_segment(cs));
+
+	/* Checkpoint. */
+	if ((s->interval > 0) && (s->offset == s->mark))
+		lzw_put_mark(s, cs);
+}
+
+/*
+ * Hands input data to the compressor, summing it up
+ * and ending checksummed segments along the way.
+ */
+static void lzw_put_bytes(
+	struct lzw_session *s,
+	struct checksum *cs,
+	const unsigned char *data,
+	size_t n)
+{
+	while (n > 0)
+	{
+		size_t len = n;
+
+		if ((s->interval > 0) && (len > s->mark - s->offset))
+			len = s->mark - s->offset;
+
+		if (s->crc)
+		{
+			if ((s->opts.crc) && (len > CRC_SEGMENT - cs->len))
+				len = CRC_SEGMENT - cs->len;
+			checksum_update(cs, data, len);
+		}
+
+		for (size_t k = 0; k < len; k++)
+			lzw_put_byte(s, data[k]);
+
+		data += len;
+		n -= len;
+		s->offset += len;
+
+		lzw_put_marks(s, cs);
+	}
+}
+
+/*
+ * Hands the pending chunk to the compressor, as a reference
+ * if it was seen recently. References may not span segment
+ * or checkpoint boundaries.
+ */
+static void lzw_put_chunk(struct lzw_session *s, struct checksum *cs)
+{
+	struct dedup *dd = s->dedup;
+	uint64_t dist;
+
+	if (dd->n == 0)
+		return;
+
+	dist = dedup_chunk(dd, s->offset);
+
+	if ((s->opts.crc) && (dd->n > CRC_SEGMENT - cs->len))
+		dist = 0;
+	if ((s->interval > 0) && (dd->n > s->mark - s->offset))
+		dist = 0;
+
+	/* Unique chunk. */
+	if (dist == 0)
+		lzw_put_bytes(s, cs, dd->chunk, dd->n);
+
+	/* Repeated chunk. */
+	else
+	{
+		if (s->crc)
+			checksum_update(cs, dd->chunk, dd->n);
+
+		buffer_put(s->inbuf, TOKEN_REF);
+		for (int k = 24; k >= 0; k -= 8)
+			buffer_put(s->inbuf, (dist >> k) & 0xff);
+		buffer_put(s->inbuf, (dd->n >> 8) & 0xff);
+		buffer_put(s->inbuf, dd->n & 0xff);
+
+		/* After the reference, so that the verifier can go on. */
+		if (s->refbuf != NULL)
+		{
+			for (size_t k = 0; k < dd->n; k++)
+				buffer_put(s->refbuf, dd->chunk[k]);
+		}
+
+		s->offset += dd->n;
+		lzw_put_marks(s, cs);
+	}
+
+	dd->n = 0;
+	dd->hash = 0;
+}
+
+/*
+ * Hands input data to the compressor, cut into chunks
+ * first in dedup mode.
+ */
+static void lzw_put_input(
+	struct lzw_session *s,
+	struct checksum *cs,
+	const unsigned char *data,
+	size_t n)
+{
+	if (s->dedup == NULL)
+	{
+		lzw_put_bytes(s, cs, data, n);
+		return;
+	}
+
+	while (n > 0)
+	{
+		int cut;
+		size_t k = dedup_scan(s->dedup, data, n, &cut);
+
+		if (cut)
+			lzw_put_chunk(s, cs);
+
+		data += k;
+		n -= k;
+	}
+}
+
+/*
+ * Hands a sync flush to the compressor.
+ */
+static void lzw_put_flush(struct lzw_session *s, struct checksum *cs)
+{
+	if (s->dedup != NULL)
+		lzw_put_chunk(s, cs);
+
+	buffer_put(s->inbuf, TOKEN_FLUSH);
+}
+
+/*
+ * Ends input.
+ */
+static void lzw_put_end(struct lzw_session *s, struct checksum *cs)
+{
+	if (s->dedup != NULL)
+		lzw_put_chunk(s, cs);
+
+	if (s->crc)
+	{
+		checksum_segment(cs);
+		lzw_put_check(s, TOKEN_END, cs->total);
+	}
+
+	lzw_put_byte(s, EOF);
+}
+
+/*
+ * Reads data from a file.
+ */
+static void* lzw_readbytes(void * arg)
+{
+	unsigned char data[READ_CHUNK]; /* Read chunk.    */
+	struct checksum cs;             /* Input summary. */
+	size_t n;                       /* Bytes read.    */
+
+	struct lzw_session *s = arg;
+	FILE *infile = s->input;
+
+	affinity_apply(s->affinity, AFFINITY_READER);
+
+	checksum_init(&cs);
+	if (s->ckpt != NULL)
+		cs = s->ckpt->cs;
+
+	/* Read data from file to the buffer. */
+	while ((n = fread(data, 1, sizeof(data), infile)) > 0)
+		lzw_put_input(s, &cs, data, n);
+
+	lzw_put_end(s, &cs);
+	return NULL;
+}
+
+/*
+ * Reads data from a file, injecting sync flushes.
+ *
+ * Input is read straight from the file descriptor, so that a
+ * flush can be issued whenever no data arrives for a while.
+ */
+static void* lzw_readbytes_sync(void * arg)
+{
+	unsigned char data[FLUSH_CHUNK]; /* Read chunk.                  */
+	unsigned pending;                /* Bytes since last flush.      */
+	struct checksum cs;              /* Input summary.               */
+	struct pollfd pfd;               /* Polled input.                */
+	int timeout;                     /* Poll timeout (ms).           */
+	ssize_t n;                       /* Bytes read.                  */
+
+	struct lzw_session *s = arg;
+	const struct lzw_options *opts = &s->opts;
+
+	affinity_apply(s->affinity, AFFINITY_READER);
+
+	pfd.fd = fileno(s->input);
+	pfd.events = POLLIN;
+	timeout = (opts->flush_idle > 0) ? (int) opts->flush_idle : FLUSH_TICK;
+	pending = 0;
+	checksum_init(&cs);
+	if (s->ckpt != NULL)
+		cs = s->ckpt->cs;
+
+	while (1)
+	{
+		/* Explicit flush. */
+		if (atomic_exchange(&s->flush, 0) && (pending > 0))
+		{
+			lzw_put_flush(s, &cs);
+			pending = 0;
+		}
+
+		/* Wait for input. */
+		if (pending > 0)
+		{
+			int ret = poll(&pfd, 1, timeout);
+
+			if ((ret < 0) && (errno != EINTR))
+				error("cannot poll input file");
+			if (ret <= 0)
+			{
+				/* Idle flush. */
+				if ((ret == 0) && (opts->flush_idle > 0))
+				{
+					lzw_put_flush(s, &cs);
+					pending = 0;
+				}
+				continue;
+			}
+		}
+
+		n = read(pfd.fd, data, sizeof(data));
+
+		/* End of file. */
+		if (n == 0)
+			break;
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			error("cannot read input file");
+		}
+
+		for (ssize_t k = 0, len; k < n; k += len)
+		{
+			len = n - k;
+			if ((opts->flush_bytes > 0) && (len > opts->flush_bytes - pending))
+				len = opts->flush_bytes - pending;
+
+			lzw_put_input(s, &cs, &data[k], len);
+			pending += len;
+
+			/* Size flush. */
+			if (pending == opts->flush_bytes)
+			{
+				lzw_put_flush(s, &cs);
+				pending = 0;
+			}
+		}
+	}
+
+	lzw_put_end(s, &cs);
+	return NULL;
+}
+
+/*
+ * Writes data to a file.
+ */
+static void* lzw_writebytes(void* arg)
+{
+	unsigned ch;                     /* Working byte.   */
+	unsigned char data[WRITE_CHUNK]; /* Staged bytes.   */
+	size_t n;                        /* Staged length.  */
+	struct checksum cs;              /* Output summary. */
+
+	struct lzw_session *s = arg;
+	FILE* outfile = s->output;
+
+	affinity_apply(s->affinity, AFFINITY_WRITER);
+
+	checksum_init(&cs);
+	n = 0;
+
+	/* Read data from file to the buffer. */
+	while ((ch = buffer_get(s->outbuf)) != EOF)
+	{
+		if (ch < RADIX)
+		{
+			data[n++] = ch;
+			if (n < sizeof(data))
+				continue;
+		}
+
+		/* Push out everything so far. */
+		if (s->crc)
+			checksum_update(&cs, data, n);
+		if (s->history != NULL)
+			history_put(s->history, data, n);
+		lzw_write(outfile, data, n);
+		n = 0;
+
+		/* Sync flush. */
+		if (ch == TOKEN_FLUSH)
+			lzw_flush(outfile);
+
+		/* Chunk reference. */
+		else if (ch == TOKEN_REF)
+		{
+			unsigned char chunk[DEDUP_MAX];
+			uint64_t dist = lzw_get_int(s->outbuf, 4);
+			size_t len = lzw_get_int(s->outbuf, 2);
+
+			history_deref(s->history, dist, len, chunk);
+			if (s->crc)
+				checksum_update(&cs, chunk, len);
+			history_put(s->history, chunk, len);
+			lzw_write(outfile, chunk, len);
+		}
+
+		/* Checksum. */
+		else if (CHECKED(ch))
+		{
+			unsigned crc = 0;
+
+			for (int k = 0; k < 4; k++)
+				crc = (crc << 8) | buffer_get(s->outbuf);
+
+			checksum_check(&cs, ch, crc);
+
+			/* Next member. */
+			if (ch == TOKEN_END)
+				checksum_init(&cs);
+		}
+	}
+
+	lzw_write(outfile, data, n);
+
+	return NULL;
+}
+
+/*
+ * Puts a code in a buffer.
+ */
+static void lzw_emit_code(void *arg, unsigned code)
+{
+	buffer_put((buffer_t) arg, code);
+}
+
+/*
+ * Puts a string in a buffer.
+ */
+static void lzw_emit_string(void *arg, const unsigned char *str, size_t n)
+{
+	for (size_t k = 0; k < n; k++)
+		buffer_put((buffer_t) arg, str[k]);
+}
+
+/*
+ * Ends output at a byte boundary for a checkpoint, and hands the
+ * writer what is needed to carry on from there.
+ */
+static void lzw_mark(struct lzw_session *s, struct encoder *e, struct storer *st, shdict_t trail)
+{
+	unsigned char rec[24];
+
+	for (int k = 0; k < 24; k++)
+		rec[k] = buffer_get(s->inbuf);
+
+	if (st != NULL)
+		storer_flush(st);
+	else if (e->i != 0)
+		encoder_flush(e);
+	else
+		e->emit(e->arg, TOKEN_FLUSH);
+
+	lzw_trail(trail, e->dict, e->first, e->code);
+
+	buffer_put(s->outbuf, TOKEN_MARK);
+	for (int k = 0; k < 24; k++)
+		buffer_put(s->outbuf, rec[k]);
+	buffer_put(s->outbuf, (trail->nentries >> 8) & 0xff);
+	buffer_put(s->outbuf, trail->nentries & 0xff);
+	for (int k = 0; k < trail->nentries; k++)
+	{
+		buffer_put(s->outbuf, (trail->entries[k].parent >> 8) & 0xff);
+		buffer_put(s->outbuf, trail->entries[k].parent & 0xff);
+		buffer_put(s->outbuf, trail->entries[k].ch);
+	}
+}
+
+/*
+ * Compress data.
+ */
+static void* lzw_compress(void* arg)
+{
+	unsigned ch;       /* Working character. */
+	struct encoder e;  /* Encoder.           */
+
+	struct storer st;  /* Storer.            */
+	size_t since;      /* Input since cut.   */
+	shdict_t trail;    /* Dictionary trail.  */
+
+	struct lzw_session *s = arg;
+	void (*emit)(void *, unsigned);
+	void *sink;
+
+	affinity_apply(s->affinity, AFFINITY_WORKER);
+
+	emit = lzw_emit_code;
+	sink = s->outbuf;
+	since = 0;
+
+	/* Stored segments. */
+	if (s->opts.store)
+	{
+		storer_init(&st, s, &e, emit, sink);
+		emit = storer_hold;
+		sink = &st;
+	}
+
+	encoder_init(&e, s, dictionary_create(1 << WIDTH, s->arena), emit, sink);
+	if (s->resume != NULL)
+		encoder_resume(&e, s->resume);
+
+	/* Checkpoints and appends save the dictionary. */
+	trail = NULL;
+	if ((s->interval > 0) || (s->opts.append))
+		trail = lzw_trail_create(s->arena);
+
+	/* Compress data. */
+	while ((ch = buffer_get(s->inbuf)) != EOF)
+	{
+		/*
+		 * Entropy coded blocks are only verified once written,
+		 * so keep the input they cover within the input copy.
+		 */
+		if ((s->entropy) && (s->refbuf != NULL) && (since >= VERIFY_CUT))
+		{
+			buffer_put(s->outbuf, TOKEN_CUT);
+			since = 0;
+		}
+
+		/* Checkpoint. */
+		if (ch == TOKEN_MARK)
+			lzw_mark(s, &e, (s->opts.store) ? &st : NULL, trail);
+
+		/* Chunk reference. */
+		else if (ch == TOKEN_REF)
+		{
+			unsigned char ref[6];
+
+			for (int k = 0; k < 6; k++)
+				ref[k] = buffer_get(s->inbuf);
+			since += (ref[4] << 8) | ref[5];
+
+			if (s->opts.store)
+				storer_ref(&st, ref);
+			else
+				encoder_ref(&e, ref);
+		}
+
+		/* Checksum. */
+		else if (CHECKED(ch))
+		{
+			unsigned crc = 0;
+
+			for (int k = 0; k < 4; k++)
+				crc = (crc << 8) | buffer_get(s->inbuf);
+
+			if (s->opts.store)
+				storer_check(&st, ch, crc);
+			else
+				encoder_check(&e, ch, crc);
+		}
+
+		else if (s->opts.store)
+		{
+			if (ch == TOKEN_FLUSH)
+				storer_flush(&st);
+			else
+				storer_put(&st, ch);
+		}
+
+		else if (ch == TOKEN_FLUSH)
+			encoder_flush(&e);
+		else
+			encoder_put(&e, ch);
+
+		since++;
+	}
+
+	if (s->opts.store)
+		storer_end(&st);
+	else
+		encoder_end(&e);
+
+	/* Append mode. */
+	if (s->opts.append)
+		s->trail = lzw_trail(trail, e.dict, e.first, e.code);
+
+	buffer_put(s->outbuf, EOF);
+
+	return NULL;
+}
+
+/*
+ * Compares decoded data against the input.
+ */
+static void lzw_check_string(void *arg, const unsigned char *str, size_t n)
+{
+	struct lzw_session *s = arg;
+
+	for (size_t k = 0; k < n; k++)
+	{
+		if (buffer_get(s->refbuf) != str[k])
+			error("verification failed");
+	}
+
+	if (s->history != NULL)
+		history_put(s->history, str, n);
+}
+
+/*
+ * Reads the next written code for the verifier.
+ */
+static unsigned lzw_verify_code(struct lzw_session *s, struct bitreader *br, struct unpacker *u)
+{
+	unsigned ch;
+	unsigned code;
+
+	if (u != NULL)
+		return (unpacker_get(u));
+
+	do
+	{
+		if ((ch = buffer_get(s->chkbuf)) == EOF)
+			return (EOF);
+	} while ((code = bitreader_put(br, ch)) == TOKEN_NONE);
+
+	return (code);
+}
+
+/*
+ * Reads the next written raw byte for the verifier.
+ */
+static unsigned char lzw_verify_byte(struct lzw_session *s, struct unpacker *u)
+{
+	unsigned ch;
+
+	if (u != NULL)
+		return (unpacker_byte(u));
+
+	if ((ch = buffer_get(s->chkbuf)) == EOF)
+		error("verification failed");
+
+	return (ch);
+}
+
+/*
+ * Verifies compressed data.
+ *
+ * The bytes the writer puts out are decoded as they come, and the
+ * result is checked against a copy of the input, so that the stream
+ * is known to round trip when compression finishes.
+ */
+static void* lzw_verify(void* arg)
+{
+	unsigned code;       /* Working code. */
+	struct decoder d;    /* Decoder.      */
+	struct bitreader br; /* Bit reader.   */
+	struct unpacker u;   /* Unpacker.     */
+	struct unpacker *up; /* Entropy?      */
+
+	struct lzw_session *s = arg;
+
+	affinity_apply(s->affinity, AFFINITY_WORKER);
+
+	decoder_init(&d, s, lzw_check_string, s);
+	if (s->resume != NULL)
+		decoder_resume(&d, s->resume);
+
+	bitreader_init(&br, s->control);
+	unpacker_init(&u, NULL, s->chkbuf);
+	up = (s->entropy) ? &u : NULL;
+
+	while ((code = lzw_verify_code(s, &br, up)) != EOF)
+	{
+		decoder_put(&d, code);
+
+		/* Check stored segment. */
+		if (STORED(code))
+		{
+			for (unsigned k = code & 0xffff; k > 0; k--)
+			{
+				unsigned char byte = lzw_verify_byte(s, up);
+
+				decoder_raw(&d, &byte, 1);
+			}
+		}
+
+		/* Check referenced chunk. */
+		else if (code == TOKEN_REF)
+		{
+			unsigned char chunk[DEDUP_MAX];
+			uint64_t dist = (up != NULL) ? u.word : br.word;
+			size_t len;
+
+			len = lzw_verify_byte(s, up) << 8;
+			len |= lzw_verify_byte(s, up);
+
+			history_deref(s->history, dist, len, chunk);
+			lzw_check_string(s, chunk, len);
+		}
+	}
+
+	/* Truncated stream. */
+	if (buffer_get(s->refbuf) != EOF)
+		error("verification failed");
+
+	return NULL;
+}
+
+/*
+ * Decompress data.
+ */
+static void* lzw_decompress(void* arg)
+{
+	unsigned code;    /* Working code. */
+	struct decoder d; /* Decoder.      */
+
+	struct lzw_session *s = arg;
+
+	affinity_apply(s->affinity, AFFINITY_WORKER);
+
+	decoder_init(&d, s, lzw_emit_string, s->outbuf);
+
+	/* Decompress data. */
+	while ((code = buffer_get(s->inbuf)) != EOF)
+	{
+		decoder_put(&d, code);
+
+		/* Hand everything out. */
+		if (code == TOKEN_FLUSH)
+			buffer_put(s->outbuf, TOKEN_FLUSH);
+
+		/* Copy stored segment. */
+		else if (STORED(code))
+		{
+			for (unsigned k = code & 0xffff; k > 0; k--)
+				buffer_put(s->outbuf, buffer_get(s->inbuf));
+		}
+
+		/* Pass checksum on. */
+		else if (CHECKED(code))
+		{
+			buffer_put(s->outbuf, code);
+			for (int k = 0; k < 4; k++)
+				buffer_put(s->outbuf, buffer_get(s->inbuf));
+		}
+
+		/* Pass reference on. */
+		else if (code == TOKEN_REF)
+		{
+			buffer_put(s->outbuf, code);
+			for (int k = 0; k < 6; k++)
+				buffer_put(s->outbuf, buffer_get(s->inbuf));
+		}
+	}
+
+	buffer_put(s->outbuf, EOF);
+
+	return NULL;
+}
+
+/*============================================================================*
+ *                                 Pool Mode                                  *
+ *============================================================================*/
+
+/*
+ * Room for a compressed block. Entropy coding may add a few bytes
+ * to each of its own blocks, which are cut at most every 8 KiB of
+ * stored data or every ENTROPY_SYMBOLS codes.
+ */
+static size_t lzw_block_room(size_t size, int entropy)
+{
+	return (size/2*3 + 16 + ((entropy) ? 4*(size/STORE_WINDOW + 4) : 0));
+}
+
+/*
+ * Memory used by a block in flight.
+ */
+static size_t lzw_block_footprint(size_t size, int verify, int store, int entropy)
+{
+	size_t footprint;
+
+	footprint = sizeof(struct block) + size + lzw_block_room(size, entropy) +
+		dictionary_footprint(1 << WIDTH) + 3*64;
+
+	/* Verifier. */
+	if (verify)
+		footprint += sizeof(struct decoder) + decoder_footprint() + 64;
+
+	/* Storer. */
+	if (store)
+		footprint += sizeof(struct storer) + storer_footprint() + 64;
+
+	/* Packer. */
+	if (entropy)
+		footprint += sizeof(struct packer) + packer_footprint() + 64;
+
+	return (footprint);
+}
+
+/*
+ * Packs a code into a block.
+ */
+static void lzw_emit_bits(void *arg, unsigned code)
+{
+	bitwriter_put((struct bitwriter *) arg, code);
+}
+
+/*
+ * Packs a code into a block, entropy coded.
+ */
+static void lzw_emit_packed(void *arg, unsigned code)
+{
+	packer_put((struct packer *) arg, code);
+}
+
+/*
+ * Writes a string to a file.
+ */
+static void lzw_emit_file(void *arg, const unsigned char *str, size_t n)
+{
+	lzw_write((FILE *) arg, str, n);
+}
+
+/*
+ * Output file with a running checksum and history.
+ */
+struct sink
+{
+	FILE *file;           /* Output file.              */
+	int crc;              /* Sum output up?            */
+	struct checksum cs;   /* Output summary.           */
+	struct history *hist; /* Output history (or NULL). */
+};
+
+/*
+ * Writes a string to a file, summing it up and
+ * keeping it for chunk references.
+ */
+static void lzw_emit_checked(void *arg, const unsigned char *str, size_t n)
+{
+	struct sink *out = arg;
+
+	if (out->crc)
+		checksum_update(&out->cs, str, n);
+	if (out->hist != NULL)
+		history_put(out->hist, str, n);
+	lzw_write(out->file, str, n);
+}
+
+/*
+ * Compares decoded data against the input of a block.
+ */
+static void lzw_check_block(void *arg, const unsigned char *str, size_t n)
+{
+	struct block *b = arg;
+
+	if ((n > b->n - b->checked) || memcmp(&b->in[b->checked], str, n))
+		error("verification failed");
+
+	b->checked += n;
+}
+
+/*
+ * Verifies an entropy coded block.
+ */
+static void lzw_block_unpack(struct block *b)
+{
+	unsigned code;
+	struct unpacker u;
+
+	unpacker_memory(&u, b->out, b->len);
+
+	while ((code = unpacker_get(&u)) != EOF)
+	{
+		decoder_put(b->check, code);
+
+		/* Check stored segment. */
+		if (STORED(code))
+		{
+			unsigned char data[STORE_WINDOW];
+			size_t n = code & 0xffff;
+
+			for (size_t k = 0; k < n; k++)
+				data[k] = unpacker_byte(&u);
+
+			decoder_raw(b->check, data, n);
+		}
+	}
+}
+
+/*
+ * Verifies a compressed block.
+ */
+static void lzw_block_verify(struct block *b)
+{
+	unsigned code;
+	struct bitreader br;
+
+	bitreader_init(&br, b->s->control);
+
+	if ((b->first) && (b->s->resume != NULL))
+		decoder_resume(b->check, b->s->resume);
+	else
+		decoder_reset(b->check);
+	b->checked = 0;
+
+	/* Entropy coded. */
+	if (b->pack != NULL)
+		lzw_block_unpack(b);
+
+	else
+	{
+		for (size_t k = 0; k < b->len; k++)
+		{
+			if ((code = bitreader_put(&br, b->out[k])) == TOKEN_NONE)
+				continue;
+
+			decoder_put(b->check, code);
+
+			/* Check stored segment. */
+			if (STORED(code))
+			{
+				decoder_raw(b->check, &b->out[k + 1], code & 0xffff);
+				k += code & 0xffff;
+			}
+		}
+	}
+
+	/* Truncated block. */
+	if (b->checked != b->n)
+		error("verification failed");
+}
+
+/*
+ * Compresses a block.
+ *
+ * Blocks start from a fresh dictionary and end at a byte boundary,
+ * so they are independent and can be simply concatenated.
+ */
+static void lzw_block_compress(void *arg)
+{
+	struct block *b = arg;
+	struct bitwriter bw;
+	struct encoder e;
+	void (*emit)(void *, unsigned);
+	void *sink;
+
+	bitwriter_init(&bw, b->out);
+	emit = lzw_emit_bits;
+	sink = &bw;
+
+	/* Entropy coding. */
+	if (b->pack != NULL)
+	{
+		b->pack->len = 0;
+		emit = lzw_emit_packed;
+		sink = b->pack;
+	}
+
+	if (!b->first)
+		emit(sink, CODE_RESET);
+
+	/* Stored segments. */
+	if (b->store != NULL)
+	{
+		encoder_init(&e, b->s, b->dict, storer_hold, b->store);
+		if ((b->first) && (b->s->resume != NULL))
+			encoder_resume(&e, b->s->resume);
+		b->store->e = &e;
+		b->store->emit = emit;
+		b->store->arg = sink;
+		storer_reset(b->store);
+
+		for (size_t k = 0; k < b->n; k++)
+			storer_put(b->store, b->in[k]);
+
+		storer_end(b->store);
+	}
+
+	else
+	{
+		encoder_init(&e, b->s, b->dict, emit, sink);
+		if ((b->first) && (b->s->resume != NULL))
+			encoder_resume(&e, b->s->resume);
+
+		for (size_t k = 0; k < b->n; k++)
+			encoder_put(&e, b->in[k]);
+
+		encoder_end(&e);
+	}
+
+	b->code = e.code;
+
+	if (b->s->crc)
+		b->crc = crc32c(0, b->in, b->n);
+
+	/* End block with its checksum, or just pad it. */
+	if (b->s->opts.crc)
+	{
+		emit(sink, TOKEN_CRC);
+		for (int k = 24; k >= 0; k -= 8)
+			emit(sink, (b->crc >> k) & 0xff);
+	}
+	else
+		emit(sink, TOKEN_FLUSH);
+
+	b->len = bw.len;
+	if (b->pack != NULL)
+	{
+		packer_end(b->pack);
+		b->len = b->pack->len;
+	}
+
+	if (b->check != NULL)
+		lzw_block_verify(b);
+}
+
+/*
+ * Writes a compressed block, in order.
+ */
+static void lzw_block_write(void *arg)
+{
+	struct block *b = arg;
+
+	struct lzw_session *s = b->s;
+
+	lzw_write(s->output, b->out, b->len);
+
+	if (s->crc)
+		s->total = crc32c_combine(s->total, b->crc, b->n);
+
+	s->offset += b->n;
+
+	/* Checkpoint, at the first block boundary past the mark. */
+	if ((s->interval > 0) && (s->offset >= s->mark))
+	{
+		struct checkpoint ck;
+		struct shdict empty;
+
+		empty.id = 0;
+		empty.nentries = 0;
+		empty.entries = NULL;
+
+		ck.input = s->offset;
+		checksum_init(&ck.cs);
+		ck.cs.total = s->total;
+		ck.dict = &empty;
+		lzw_checkpoint(s, &ck);
+
+		s->mark = s->offset + s->interval;
+	}
+}
+
+/*
+ * Sets up a block, carving its buffers from the session arena.
+ */
+static void lzw_block_init(struct lzw_session *s, struct block *b, size_t size, int verify)
+{
+	b->s = s;
+	b->in = arena_alloc(s->arena, size);
+	b->out = arena_alloc(s->arena, lzw_block_room(size, s->entropy));
+	b->dict = dictionary_create(1 << WIDTH, s->arena);
+	b->check = NULL;
+	b->store = NULL;
+	b->pack = NULL;
+
+	if (s->entropy)
+	{
+		b->pack = arena_alloc(s->arena, sizeof(struct packer));
+		packer_init(b->pack, s->arena, b->out);
+	}
+
+	if (s->opts.store)
+	{
+		b->store = arena_alloc(s->arena, sizeof(struct storer));
+		storer_init(b->store, s, NULL, lzw_emit_bits, NULL);
+	}
+
+	if (verify)
+	{
+		b->check = arena_alloc(s->arena, sizeof(struct decoder));
+		decoder_init(b->check, s, lzw_check_block, b);
+	}
+}
+
+/*
+ * Compresses a file on the session's thread pool.
+ */
+static void lzw_pool_compress(struct lzw_session *s)
+{
+	struct block *blocks;
+	pool_batch_t batch;
+	unsigned seq;
+	size_t size;
+
+	size = s->opts.block_size;
+	blocks = arena_alloc(s->arena, s->nblocks*sizeof(struct block));
+	for (unsigned k = 0; k < s->nblocks; k++)
+		lzw_block_init(s, &blocks[k], size, s->opts.verify);
+
+	batch = pool_batch_create(s->opts.pool, s->nblocks, lzw_block_write, s->arena);
+	s->total = (s->ckpt != NULL) ? s->ckpt->cs.total : 0;
+
+	for (seq = 0; /* noop */; seq++)
+	{
+		struct block *b = &blocks[seq % s->nblocks];
+
+		/* Wait for the block to be written. */
+		pool_batch_wait(batch, s->nblocks - 1);
+
+		b->first = (seq == 0) && (s->ckpt == NULL);
+		b->n = fread(b->in, 1, size, s->input);
+
+		if (b->n == 0)
+			break;
+
+		pool_batch_submit(batch, lzw_block_compress, b);
+	}
+
+	pool_batch_destroy(batch);
+
+	/* Append mode: the last block holds the dictionary left behind. */
+	if (s->opts.append)
+	{
+		struct block *last = &blocks[(seq + s->nblocks - 1) % s->nblocks];
+
+		if (seq > 0)
+			s->trail = lzw_trail(lzw_trail_create(s->arena),
+				last->dict, s->first, last->code);
+	}
+
+	/* Stream checksum. */
+	if (s->crc)
+	{
+		unsigned char data[16];
+		struct bitwriter bw;
+		struct packer *pk = blocks[0].pack;
+		size_t len;
+
+		/* Entropy coded, in a block of its own. */
+		if (pk != NULL)
+		{
+			pk->out = data;
+			pk->len = 0;
+			packer_put(pk, TOKEN_END);
+			for (int k = 24; k >= 0; k -= 8)
+				packer_put(pk, (s->total >> k) & 0xff);
+			len = pk->len;
+		}
+
+		else
+		{
+			bitwriter_init(&bw, data);
+			bitwriter_put(&bw, TOKEN_END);
+			for (int k = 24; k >= 0; k -= 8)
+				bitwriter_put(&bw, (s->total >> k) & 0xff);
+			len = bw.len;
+		}
+
+		lzw_write(s->output, data, len);
+	}
+}
+
+/*
+ * Reads the next code of a stream on the calling thread, from its
+ * bits or, if it is entropy coded, its symbols. Returns EOF at the
+ * end of the input.
+ */
+static unsigned lzw_inline_code(struct lzw_session *s, struct bitreader *br, struct unpacker *u)
+{
+	int ch;
+	unsigned code;
+
+	if (u != NULL)
+		return (unpacker_get(u));
+
+	while ((ch = getc(s->input)) != EOF)
+	{
+		if ((code = bitreader_put(br, ch)) != TOKEN_NONE)
+			return (code);
+	}
+
+	return (EOF);
+}
+
+/*
+ * Reads raw bytes of a stream on the calling thread.
+ */
+static void lzw_inline_bytes(struct lzw_session *s, struct unpacker *u, unsigned char *data, size_t n)
+{
+	if (u != NULL)
+	{
+		for (size_t k = 0; k < n; k++)
+			data[k] = unpacker_byte(u);
+	}
+
+	else if (fread(data, 1, n, s->input) != n)
+		error("broken file");
+}
+
+/*
+ * Starts the next member of an archive on the calling thread, once
+ * the current one has ended. Returns its flags, or zero at the end
+ * of the input.
+ */
+static int lzw_inline_member(struct lzw_session *s, struct bitreader *br, struct unpacker *u)
+{
+	int flags = lzw_readmember(s->input, &s->opts);
+
+	/* End of stream. */
+	if (flags == 0)
+		return (0);
+
+	/* Members are all entropy coded, or none is. */
+	if (((flags & HEADER_ENTROPY) != 0) != s->entropy)
+		error("broken file");
+
+	bitreader_init(br, s->control);
+	if (u != NULL)
+		unpacker_init(u, s->input, NULL);
+
+	return (flags);
+}
+
+/*
+ * Decompresses a file on the calling thread.
+ */
+static void lzw_inline_decompress(struct lzw_session *s)
+{
+	unsigned code;
+	struct bitreader br;
+	struct unpacker u;
+	struct unpacker *up;
+	struct decoder d;
+	struct sink out;
+	int ended = 0;
+
+	bitreader_init(&br, s->control);
+	unpacker_init(&u, s->input, NULL);
+	up = (s->entropy) ? &u : NULL;
+
+	out.file = s->output;
+	out.crc = s->crc;
+	checksum_init(&out.cs);
+	out.hist = s->history;
+
+	if ((s->crc) || (s->history != NULL))
+		decoder_init(&d, s, lzw_emit_checked, &out);
+	else
+		decoder_init(&d, s, lzw_emit_file, s->output);
+
+	while ((code = lzw_inline_code(s, &br, up)) != EOF)
+	{
+		uint64_t word = (up != NULL) ? u.word : br.word;
+
+		decoder_put(&d, code);
+
+		/* Checksum. */
+		if (CHECKED(code))
+		{
+			checksum_check(&out.cs, code, word);
+
+			/* End of member. */
+			if (code == TOKEN_END)
+			{
+				int flags = lzw_inline_member(s, &br, up);
+
+				/* End of stream. */
+				if (flags == 0)
+				{
+					ended = 1;
+					break;
+				}
+
+				if (!(flags & HEADER_CONTINUE))
+					decoder_reset(&d);
+				checksum_init(&out.cs);
+			}
+		}
+
+		/* Copy stored segment. */
+		if (STORED(code))
+		{
+			unsigned char data[STORE_WINDOW];
+			size_t n = code & 0xffff;
+
+			while (n > 0)
+			{
+				size_t len = (n < sizeof(data)) ? n : sizeof(data);
+
+				lzw_inline_bytes(s, up, data, len);
+				decoder_raw(&d, data, len);
+				n -= len;
+			}
+		}
+
+		/* Copy referenced chunk. */
+		else if (code == TOKEN_REF)
+		{
+			unsigned char chunk[DEDUP_MAX];
+			unsigned char len[2];
+
+			lzw_inline_bytes(s, up, len, 2);
+			history_deref(s->history, word, (len[0] << 8) | len[1], chunk);
+			lzw_emit_checked(&out, chunk, (len[0] << 8) | len[1]);
+		}
+	}
+
+	/* Missing stream checksum. */
+	if ((s->crc) && (!ended))
+		error("truncated file");
+}
+
+/*============================================================================*
+ *                                Append Mode                                 *
+ *============================================================================*/
+
+/*
+ * Magic of dictionary state files.
+ */
+#define STATE_MAGIC "LZS1"
+
+/*
+ * Loads the dictionary state saved when an archive of a given size
+ * was last appended to. Returns NULL if there is no state, or if the
+ * archive was changed by someone else since.
+ */
+static shdict_t lzw_loadstate(const char *filename, long size)
+{
+	FILE *file;
+	char magic[4];
+	uint64_t saved;
+	shdict_t state;
+
+	if ((filename == NULL) || ((file = fopen(filename, "rb")) == NULL))
+		return (NULL);
+
+	state = NULL;
+
+	/* Bad state file. */
+	if ((fread(magic, 1, 4, file) != 4) || (memcmp(magic, STATE_MAGIC, 4)))
+		warning("bad dictionary state, starting over");
+
+	else
+	{
+		saved = 0;
+		for (int k = 0; k < 8; k++)
+			saved = (saved << 8) | (fgetc(file) & 0xff);
+
+		if (saved == (uint64_t) size)
+			state = shdict_read(file);
+		else
+			warning("stale dictionary state, starting over");
+	}
+
+	fclose(file);
+
+	return (state);
+}
+
+/*
+ * Saves the dictionary state of an archive of a given size.
+ */
+static void lzw_savestate(const char *filename, shdict_t state, long size)
+{
+	FILE *file;
+
+	file = fopen(filename, "wb");
+	if (file == NULL)
+		error("cannot open dictionary state file");
+
+	fwrite(STATE_MAGIC, 1, 4, file);
+	for (int k = 56; k >= 0; k -= 8)
+		fputc(((uint64_t) size >> k) & 0xff, file);
+	shdict_write(state, file);
+
+	if (fclose(file) != 0)
+		error("cannot write dictionary state file");
+}
+
+/*
+ * Asserts if an archive ends with a stream checksum. The record
+ * is byte aligned, so its control code sits in one of two ways.
+ */
+static int lzw_ended(const unsigned char *tail)
+{
+	if ((tail[0] == (CODE_END >> 4)) && (tail[1] == ((CODE_END & 0xf) << 4)))
+		return (1);
+
+	return (((tail[0] & 0xf) == (CODE_END >> 8)) && (tail[1] == (CODE_END & 0xff)));
+}
+
+/*
+ * Gets an archive ready for a new member, which continues the
+ * dictionary of the last one if its state was saved. Returns the
+ * flags that the member header needs, which follow the archive
+ * where it differs from the options.
+ */
+static int lzw_append_begin(struct lzw_session *s, FILE *output)
+{
+	unsigned char tail[6];
+	long size;
+	int archive;
+	int flags;
+
+	size = (fseek(output, 0, SEEK_END) == 0) ? ftell(output) : -1;
+	if (size < 0)
+		error("cannot append to output file");
+
+	flags = lzw_flags(&s->opts, HEADER_MEMBER);
+
+	/* New archive. */
+	if (size == 0)
+		return (flags);
+
+	rewind(output);
+	archive = lzw_readheader(output, &s->opts);
+
+	/* Nothing marks where the stream ends. */
+	if (!(archive & (HEADER_CRC | HEADER_MEMBER)))
+		error("cannot append to this stream");
+
+	/* Extractors only keep a history if the first member needs one. */
+	if ((flags & HEADER_DEDUP) && (!(archive & HEADER_DEDUP)))
+	{
+		warning("archive is not deduplicated, appending without it");
+		flags &= ~HEADER_DEDUP;
+	}
+
+	/* Members are all entropy coded, or none is. */
+	if ((flags & HEADER_ENTROPY) && (!(archive & HEADER_ENTROPY)))
+		warning("archive is not entropy coded, appending without it");
+	flags = (flags & ~HEADER_ENTROPY) | (archive & HEADER_ENTROPY);
+
+	/* Last member was cut short. */
+	if ((fseek(output, -6, SEEK_END) != 0) ||
+		(fread(tail, 1, 6, output) != 6) || (!lzw_ended(tail)))
+		error("truncated file");
+
+	fseek(output, 0, SEEK_END);
+
+	s->resume = lzw_loadstate(s->opts.state, size);
+
+	return (flags | ((s->resume != NULL) ? HEADER_CONTINUE : 0));
+}
+
+/*
+ * Saves the dictionary left behind by a new member.
+ */
+static void lzw_append_end(struct lzw_session *s)
+{
+	shdict_t state;
+
+	state = (s->trail != NULL) ? s->trail : s->resume;
+
+	if ((s->opts.state != NULL) && (state != NULL))
+	{
+		fflush(s->output);
+		lzw_savestate(s->opts.state, state, ftell(s->output));
+	}
+
+	if (s->resume != NULL)
+		shdict_destroy(s->resume);
+	s->trail = NULL;
+	s->resume = NULL;
+}
+
+/*============================================================================*
+ *                                 Estimation                                 *
+ *============================================================================*/
+
+/*
+ * Returns the 97.5% quantile of Student's t distribution.
+ */
+static double lzw_student(unsigned df)
+{
+	static const double t[ESTIMATE_WINDOWS] = {
+		0.000, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365,
+		2.306,  2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131
+	};
+
+	return ((df < ESTIMATE_WINDOWS) ? t[df] : 1.960);
+}
+
+/*
+ * Returns the half width of a 95% confidence interval for the mean
+ * of some samples, shrunk by a finite population correction.
+ */
+static double lzw_interval(const double *x, unsigned n, double fpc)
+{
+	double mean = 0;
+	double var = 0;
+
+	if (n < 2)
+		return (0);
+
+	for (unsigned k = 0; k < n; k++)
+		mean += x[k];
+	mean /= n;
+
+	for (unsigned k = 0; k < n; k++)
+		var += (x[k] - mean)*(x[k] - mean);
+	var /= n - 1;
+
+	return (lzw_student(n - 1)*sqrt(var/n)*fpc);
+}
+
+/*
+ * Returns the monotonic clock, in seconds.
+ */
+static double lzw_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec + ts.tv_nsec*1e-9);
+}
+
+/*
+ * Sampled input kept in memory, to time the session pipeline on.
+ */
+struct lzw_slice
+{
+	unsigned char *data; /* Sampled windows.                   */
+	size_t size;         /* Room (0: nothing kept).            */
+	size_t len;          /* Bytes kept.                        */
+	double time;         /* Time compressing them as blocks.   */
+};
+
+/*
+ * Compresses a sampled window, adds it up to an estimate,
+ * and keeps a copy of it in a slice while there is room.
+ */
+static void lzw_sample(
+	struct block *b,
+	struct lzw_estimate *est,
+	double *ratio,
+	double *cost,
+	struct lzw_slice *sl)
+{
+	double t;
+
+	t = lzw_clock();
+	lzw_block_compress(b);
+	t = lzw_clock() - t;
+
+	*ratio = (double) b->len/b->n;
+	*cost = t/b->n;
+
+	est->ratio += b->len;
+	est->speed += t;
+	est->sampled += b->n;
+
+	if (sl->len + b->n <= sl->size)
+	{
+		memcpy(&sl->data[sl->len], b->in, b->n);
+		sl->len += b->n;
+		sl->time += t;
+	}
+}
+
+/*
+ * Returns the bytes a stream takes besides its blocks: header and
+ * the closing checksum.
+ */
+static size_t lzw_overhead(struct lzw_session *s, int flags)
+{
+	size_t overhead = 0;
+
+	if (flags != 0)
+		overhead += 3 + ((flags & HEADER_SHDICT) ? 4 : 0);
+	if (flags & ~0xff)
+		overhead++;
+	if (s->crc)
+		overhead += (s->entropy) ? 9 : 6;
+
+	return (overhead);
+}
+
+/*============================================================================*
+ *                                   Search                                   *
+ *============================================================================*/
+
+/*
+ * Searches a code stream, taken from the session input buffer.
+ */
+static void lzw_search_codes(struct lzw_session *s, searcher_t sr)
+{
+	unsigned code;
+
+	while ((code = buffer_get(s->inbuf)) != EOF)
+	{
+		searcher_put(sr, code);
+
+		/* Search stored segment. */
+		if (STORED(code))
+		{
+			for (unsigned k = code & 0xffff; k > 0; k--)
+			{
+				unsigned char ch = buffer_get(s->inbuf);
+				searcher_raw(sr, &ch, 1);
+			}
+		}
+
+		/* Skip checksum. */
+		else if (CHECKED(code))
+		{
+			for (int k = 0; k < 4; k++)
+				buffer_get(s->inbuf);
+		}
+
+		/* Search referenced chunk. */
+		else if (code == TOKEN_REF)
+		{
+			unsigned char chunk[DEDUP_MAX];
+			uint64_t dist = lzw_get_int(s->inbuf, 4);
+			size_t len = lzw_get_int(s->inbuf, 2);
+
+			history_deref(s->history, dist, len, chunk);
+			searcher_raw(sr, chunk, len);
+		}
+	}
+}
+
+/*
+ * Searches a file on the calling thread.
+ */
+static void lzw_inline_search(struct lzw_session *s, searcher_t sr)
+{
+	unsigned code;
+	struct bitreader br;
+	struct unpacker u;
+	struct unpacker *up;
+	int ended = 0;
+
+	bitreader_init(&br, s->control);
+	unpacker_init(&u, s->input, NULL);
+	up = (s->entropy) ? &u : NULL;
+
+	while ((code = lzw_inline_code(s, &br, up)) != EOF)
+	{
+		uint64_t word = (up != NULL) ? u.word : br.word;
+
+		searcher_put(sr, code);
+
+		/* Search stored segment. */
+		if (STORED(code))
+		{
+			unsigned char data[STORE_WINDOW];
+			size_t n = code & 0xffff;
+
+			while (n > 0)
+			{
+				size_t len = (n < sizeof(data)) ? n : sizeof(data);
+
+				lzw_inline_bytes(s, up, data, len);
+				searcher_raw(sr, data, len);
+				n -= len;
+			}
+		}
+
+		/* Search referenced chunk. */
+		else if (code == TOKEN_REF)
+		{
+			unsigned char chunk[DEDUP_MAX];
+			unsigned char len[2];
+
+			lzw_inline_bytes(s, up, len, 2);
+			history_deref(s->history, word, (len[0] << 8) | len[1], chunk);
+			searcher_raw(sr, chunk, (len[0] << 8) | len[1]);
+		}
+
+		/* End of member. */
+		else if (code == TOKEN_END)
+		{
+			int flags = lzw_inline_member(s, &br, up);
+
+			/* End of stream. */
+			if (flags == 0)
+			{
+				ended = 1;
+				break;
+			}
+
+			if (!(flags & HEADER_CONTINUE))
+				searcher_put(sr, CODE_RESET);
+		}
+	}
+
+	/* Missing stream checksum. */
+	if ((s->crc) && (!ended))
+		error("truncated file");
+}
+
+/*============================================================================*
+ *                                  Sessions                                  *
+ *============================================================================*/
+
+/*
+ * Drops deduplication state. Its memory goes back with the arena.
+ */
+static void lzw_dedup_end(struct lzw_session *s)
+{
+	s->dedup = NULL;
+	s->history = NULL;
+}
+
+/*
+ * Makes sure that everything written made it out of the output
+ * stream, before a run, and its verification, succeeds.
+ */
+static void lzw_output_end(struct lzw_session *s)
+{
+	if ((fflush(s->output) != 0) || (ferror(s->output)))
+		error("cannot write output file");
+}
+
+/*
+ * Size of the input copy in verify mode. It must hold everything
+ * the compressor may have read but not yet written out, or the
+ * reader, compressor and verifier would deadlock.
+ */
+static unsigned lzw_refsize(int entropy, int dedup)
+{
+	unsigned n = BUFFER_SIZE + STORE_WINDOW + 2*(1 << WIDTH);
+
+	if (entropy)
+		n += 2*VERIFY_CUT;
+	if (dedup)
+		n += DEDUP_MAX;
+
+	return (n);
+}
+
+/*
+ * Memory that a run carves from the session arena, given the
+ * flags of its stream.
+ */
+static size_t lzw_footprint(struct lzw_session *s, int flags, int compress)
+{
+	size_t footprint = 0;
+	int entropy = (flags & HEADER_ENTROPY) != 0;
+	int dedup = (flags & HEADER_DEDUP) != 0;
+
+	/* Decompress mode, inline or on a pipeline. */
+	if (!compress)
+	{
+		footprint += decoder_footprint();
+		if (dedup)
+			footprint += history_footprint(DEDUP_WINDOW);
+		if (!lzw_pooled(&s->opts))
+			footprint += 2*buffer_footprint(BUFFER_SIZE);
+
+		return (footprint);
+	}
+
+	/* Pool mode. */
+	if (flags & HEADER_BLOCKS)
+	{
+		footprint += s->nblocks*lzw_block_footprint(s->opts.block_size,
+			s->opts.verify, s->opts.store, entropy);
+		footprint += pool_batch_footprint(s->nblocks);
+		if (s->opts.append)
+			footprint += lzw_trail_footprint();
+
+		return (footprint);
+	}
+
+	footprint += 2*buffer_footprint(BUFFER_SIZE) + dictionary_footprint(1 << WIDTH);
+	if (s->opts.store)
+		footprint += storer_footprint();
+	if (entropy)
+		footprint += packer_footprint() + packer_room() + 64;
+	if (dedup)
+		footprint += dedup_footprint();
+
+	/* Dictionary trails of the compressor and writer. */
+	if ((s->interval > 0) || (s->opts.append))
+		footprint += lzw_trail_footprint();
+	if (s->interval > 0)
+		footprint += lzw_trail_footprint();
+
+	/* Verifier. */
+	if (s->opts.verify)
+	{
+		footprint += buffer_footprint(lzw_refsize(entropy, dedup)) +
+			buffer_footprint(BUFFER_SIZE) + decoder_footprint();
+		if (dedup)
+			footprint += history_footprint(DEDUP_WINDOW);
+	}
+
+	return (footprint);
+}
+
+/*
+ * Makes sure that a run fits in the session arena, before anything
+ * is carved from it or written out. Default budgets grow to fit, and
+ * keep the room for later runs. Explicit budgets are kept as they
+ * are, and runs that do not fit in them fail.
+ */
+static void lzw_reserve(struct lzw_session *s, size_t size)
+{
+	if (size <= s->opts.memory)
+		return;
+
+	if (!s->grow)
+		error("memory budget too small");
+
+	arena_destroy(s->arena);
+	s->opts.memory = size;
+	s->arena = arena_create(s->opts.memory, affinity_node(s->affinity));
+}
+
+/*
+ * Wraps up a compression.
+ */
+static void lzw_compress_end(struct lzw_session *s)
+{
+	if (s->opts.append)
+		lzw_append_end(s);
+	if (s->opts.ckpt != NULL)
+		lzw_checkpoint_end(s);
+}
+
+/*
+ * Compresses/Decompresses the session input to its output on a
+ * reader, codec and writer thread connected by ring buffers. Sync
+ * readers poll the input file descriptor for flushes.
+ */
+static void lzw_pipeline(struct lzw_session *s, int compress, int sync)
+{
+	pthread_t reader;
+	pthread_t worker;
+	pthread_t writer;
+	pthread_t verifier;
+
+	s->inbuf = buffer_create(BUFFER_SIZE, s->arena);
+	s->outbuf = buffer_create(BUFFER_SIZE, s->arena);
+	s->refbuf = NULL;
+	s->chkbuf = NULL;
+
+	/* Verify mode. */
+	if ((compress) && (s->opts.verify))
+	{
+		s->refbuf = buffer_create(lzw_refsize(s->entropy, s->dedup != NULL), s->arena);
+		s->chkbuf = buffer_create(BUFFER_SIZE, s->arena);
+	}
+
+	/* Compress mode. */
+	if (compress)
+	{
+		pthread_create(&reader, NULL,
+			(sync) ? lzw_readbytes_sync : lzw_readbytes,
+			s
+		);
+		pthread_create(&worker, NULL, lzw_compress, s);
+		pthread_create(&writer, NULL,
+			(s->entropy) ? lzw_writesymbols : lzw_writebits,
+			s
+		);
+		if (s->chkbuf != NULL)
+			pthread_create(&verifier, NULL, lzw_verify, s);
+	}
+
+	/* Decompress mode. */
+	else
+	{
+		pthread_create(&reader, NULL,
+			(s->entropy) ? lzw_readsymbols : lzw_readbits,
+			s
+		);
+		pthread_create(&worker, NULL, lzw_decompress, s);
+		pthread_create(&writer, NULL, lzw_writebytes, s);
+	}
+
+	pthread_join(reader, NULL);
+	pthread_join(worker, NULL);
+	pthread_join(writer, NULL);
+
+	if (s->chkbuf != NULL)
+	{
+		pthread_join(verifier, NULL);
+		buffer_destroy(s->chkbuf);
+		buffer_destroy(s->refbuf);
+	}
+
+	buffer_destroy(s->outbuf);
+	buffer_destroy(s->inbuf);
+}
+
+/*
+ * Bytes of sampled input to time the session pipeline on: a window,
+ * or enough blocks to keep every pool worker busy, in whole windows
+ * and within what estimates sample.
+ */
+static size_t lzw_slicesize(struct lzw_session *s)
+{
+	size_t size = ESTIMATE_WINDOW;
+
+	if (lzw_pooled(&s->opts))
+		size = pool_workers(s->opts.pool)*s->opts.block_size;
+
+	size = (size + ESTIMATE_WINDOW - 1)/ESTIMATE_WINDOW*ESTIMATE_WINDOW;
+
+	return ((size < ESTIMATE_WINDOW*ESTIMATE_WINDOWS) ? size : ESTIMATE_WINDOW*ESTIMATE_WINDOWS);
+}
+
+/*
+ * Times the session pipeline, on its threads or its pool, over a
+ * slice of sampled input, and returns how much longer it takes than
+ * compressing the same windows as blocks did. Input and output stay
+ * in memory, and nothing is appended or checkpointed. Memory input
+ * has no file descriptor to poll, so sync flushes are left out.
+ */
+static double lzw_pace(struct lzw_session *s, struct lzw_slice *sl, int flags)
+{
+	char *out;
+	size_t len;
+	double t;
+
+	s->input = fmemopen(sl->data, sl->len, "rb");
+	s->output = open_memstream(&out, &len);
+	if ((s->input == NULL) || (s->output == NULL))
+		error("cannot open memory stream");
+
+	if (flags & HEADER_DEDUP)
+	{
+		s->dedup = dedup_create(s->arena);
+		if (s->opts.verify)
+			s->history = history_create(DEDUP_WINDOW, s->arena);
+	}
+
+	t = lzw_clock();
+	if (flags & HEADER_BLOCKS)
+		lzw_pool_compress(s);
+	else
+		lzw_pipeline(s, 1, 0);
+	lzw_output_end(s);
+	t = lzw_clock() - t;
+
+	lzw_dedup_end(s);
+	fclose(s->input);
+	fclose(s->output);
+	free(out);
+	s->input = NULL;
+	s->output = NULL;
+
+	return ((sl->time > 0) ? t/sl->time : 1);
+}
+
+/*
+ * Creates a codec session.
+ *
+ * Sessions with a thread pool start no threads of their own, so they
+ * cannot have sync flushes or deduplication, which need a pipeline.
+ */
+struct lzw_session *lzw_session_create(const struct lzw_options *opts)
+{
+	struct lzw_session *s;
+	size_t footprint;
+
+	s = smalloc(sizeof(struct lzw_session));
+
+	/* Initialize session. */
+	memset(&s->opts, 0, sizeof(struct lzw_options));
+	if (opts != NULL)
+		s->opts = *opts;
+	if (s->opts.block_size == 0)
+		s->opts.block_size = BLOCK_SIZE;
+
+	/* Shared dictionary must leave room in the code space. */
+	if ((s->opts.dict != NULL) &&
+		(s->opts.dict->nentries > (1 << WIDTH) - 1 - (RADIX + NCONTROL)))
+		error("shared dictionary too large");
+
+	/* Both need a pipeline of their own. */
+	if ((s->opts.pool != NULL) && (lzw_sync(&s->opts)))
+		error("sync flushes cannot run on a thread pool");
+	if ((s->opts.pool != NULL) && (s->opts.dedup))
+		error("deduplication cannot run on a thread pool");
+
+	/* Keep every pool worker busy, plus one block being written. */
+	s->nblocks = (s->opts.pool != NULL) ? 2*pool_workers(s->opts.pool) : 0;
+	s->interval = s->opts.checkpoint;
+	s->pace = 0;
+
+	/*
+	 * Default budget, with room to compress with these options.
+	 * Appends follow the archive on entropy coding. Runs that
+	 * need more, such as extracting deduplicated archives, grow
+	 * it when they start.
+	 */
+	s->grow = (s->opts.memory == 0);
+	if (s->grow)
+	{
+		int flags = lzw_flags(&s->opts, 0);
+
+		if (s->opts.append)
+			flags |= HEADER_ENTROPY;
+
+		s->opts.memory = SESSION_MEMORY;
+
+		footprint = lzw_footprint(s, flags, 1);
+		if (s->opts.memory < footprint)
+			s->opts.memory = footprint;
+
+		/* Room to compress a sampled window when estimating. */
+		footprint = lzw_block_footprint(ESTIMATE_WINDOW, 0,
+			s->opts.store, s->opts.entropy);
+		if (s->opts.memory < footprint)
+			s->opts.memory = footprint;
+	}
+
+	s->affinity = affinity_create(s->opts.affinity);
+	s->arena = arena_create(s->opts.memory, affinity_node(s->affinity));
+	atomic_init(&s->flush, 0);
+
+	return (s);
+}
+
+/*
+ * Destroys a codec session.
+ */
+void lzw_session_destroy(struct lzw_session *s)
+{
+	arena_destroy(s->arena);
+	affinity_destroy(s->affinity);
+	free(s);
+}
+
+/*
+ * Requests a sync flush on a running compressor.
+ *
+ * Only streams created with sync flushes enabled honor the request.
+ * This function is async-signal-safe.
+ */
+void lzw_session_flush(struct lzw_session *s)
+{
+	atomic_store(&s->flush, 1);
+}
+
+/*
+ * Compress/Decompress a file within a codec session.
+ *
+ * Sessions with a thread pool spawn no threads of their own: blocks
+ * are compressed by pool workers, and decompression runs on the
+ * calling thread. Other sessions run a reader, codec and writer
+ * thread connected by ring buffers.
+ */
+void lzw_session_run(struct lzw_session *s, FILE *input, FILE *output, int compress)
+{
+	s->input = input;
+	s->output = output;
+	s->resume = NULL;
+	s->trail = NULL;
+	s->ckpt = NULL;
+	s->offset = 0;
+	s->interval = s->opts.checkpoint;
+	s->dedup = NULL;
+	s->history = NULL;
+
+	arena_reset(s->arena);
+
+	/* Compress mode. */
+	if (compress)
+	{
+		int flags = -1;
+		int fresh;
+
+		if ((s->opts.append) && (s->opts.resume))
+			error("cannot resume an append");
+
+		if (s->opts.resume)
+			flags = lzw_resume(s);
+
+		fresh = (flags < 0);
+		if (fresh)
+			flags = (s->opts.append) ? lzw_append_begin(s, output) : lzw_flags(&s->opts, 0);
+
+		/* Fail before anything is written. */
+		lzw_reserve(s, lzw_footprint(s, flags, 1));
+
+		if (fresh)
+			lzw_writeheader(output, &s->opts, flags);
+
+		s->mark = s->offset + s->interval;
+
+		s->control = (flags != 0);
+		s->first = (s->control) ? RADIX + NCONTROL : RADIX + 1;
+		s->crc = (flags & (HEADER_CRC | HEADER_MEMBER)) != 0;
+		s->entropy = (flags & HEADER_ENTROPY) != 0;
+		atomic_store(&s->flush, 0);
+
+		if (flags & HEADER_DEDUP)
+		{
+			s->dedup = dedup_create(s->arena);
+			if (s->opts.verify)
+				s->history = history_create(DEDUP_WINDOW, s->arena);
+		}
+
+		if (flags & HEADER_BLOCKS)
+		{
+			lzw_pool_compress(s);
+			lzw_output_end(s);
+			lzw_compress_end(s);
+			return;
+		}
+	}
+
+	/* Decompress mode. */
+	else
+	{
+		int flags = lzw_readheader(input, &s->opts);
+
+		s->control = (flags != 0);
+		s->first = (s->control) ? RADIX + NCONTROL : RADIX + 1;
+		s->crc = (flags & (HEADER_CRC | HEADER_MEMBER)) != 0;
+		s->entropy = (flags & HEADER_ENTROPY) != 0;
+
+		/* Members may only continue earlier ones. */
+		if (flags & HEADER_CONTINUE)
+			error("broken file");
+
+		lzw_reserve(s, lzw_footprint(s, flags, 0));
+
+		if (flags & HEADER_DEDUP)
+			s->history = history_create(DEDUP_WINDOW, s->arena);
+
+		if (lzw_pooled(&s->opts))
+		{
+			lzw_inline_decompress(s);
+			lzw_output_end(s);
+			lzw_dedup_end(s);
+			return;
+		}
+	}
+
+	lzw_pipeline(s, compress, lzw_sync(&s->opts));
+
+	lzw_output_end(s);
+	lzw_dedup_end(s);
+	if (compress)
+		lzw_compress_end(s);
+}
+
+/*
+ * Estimates how well a file compresses within a codec session,
+ * in memory.
+ *
+ * Windows of input are compressed as pool mode blocks, one at a
+ * time on the calling thread, honoring the stored segment and
+ * entropy coding options; deduplication and sync flushes are not
+ * accounted for. Throughput is scaled to the session pipeline, on
+ * its threads or its pool, which the first estimate of a session
+ * times over a slice of its sample; later ones reuse that pace.
+ * Seekable inputs are sampled from the current position to the
+ * end, and left where they were. Other inputs are sampled from the
+ * start, and what is sampled is gone.
+ */
+void lzw_session_estimate(struct lzw_session *s, FILE *input, struct lzw_estimate *est)
+{
+	struct block b;
+	double ratio[ESTIMATE_WINDOWS];
+	double cost[ESTIMATE_WINDOWS];
+	unsigned n = 0;
+	long start, end = -1;
+	double fpc, half;
+	struct lzw_slice sl;
+	size_t footprint;
+	int flags;
+
+	s->input = input;
+	s->output = NULL;
+	s->resume = NULL;
+	s->trail = NULL;
+	s->ckpt = NULL;
+	s->offset = 0;
+	s->interval = 0;
+	s->dedup = NULL;
+	s->history = NULL;
+
+	arena_reset(s->arena);
+
+	flags = lzw_flags(&s->opts, 0);
+	s->control = (flags != 0);
+	s->first = (s->control) ? RADIX + NCONTROL : RADIX + 1;
+	s->crc = (flags & HEADER_CRC) != 0;
+	s->entropy = (flags & HEADER_ENTROPY) != 0;
+	atomic_store(&s->flush, 0);
+
+	memset(est, 0, sizeof(struct lzw_estimate));
+	est->jobs = (lzw_pooled(&s->opts)) ? pool_workers(s->opts.pool) : 0;
+
+	/* Keep a slice of the sample until the pipeline is timed. */
+	memset(&sl, 0, sizeof(struct lzw_slice));
+	if (s->pace == 0)
+		sl.size = lzw_slicesize(s);
+
+	footprint = lzw_block_footprint(ESTIMATE_WINDOW, 0, s->opts.store, s->entropy);
+	if (sl.size > 0)
+		footprint += sl.size + 64 + lzw_footprint(s, flags, 1);
+	lzw_reserve(s, footprint);
+
+	if (sl.size > 0)
+		sl.data = arena_alloc(s->arena, sl.size);
+	lzw_block_init(s, &b, ESTIMATE_WINDOW, 0);
+	b.first = 1;
+
+	/* Seekable input. */
+	start = ftell(input);
+	if ((start >= 0) && (fseek(input, 0, SEEK_END) == 0))
+		end = ftell(input);
+
+	/* Sample evenly spaced windows. */
+	if ((end >= start) && (end - start > ESTIMATE_WINDOW*ESTIMATE_WINDOWS))
+	{
+		long span = end - start - ESTIMATE_WINDOW;
+
+		est->size = end - start;
+
+		for (n = 0; n < ESTIMATE_WINDOWS; n++)
+		{
+			long offset = start + span/(ESTIMATE_WINDOWS - 1)*n;
+
+			if (fseek(input, offset, SEEK_SET) != 0)
+				error("cannot seek input file");
+			b.n = fread(b.in, 1, ESTIMATE_WINDOW, input);
+			if (b.n == 0)
+				error("cannot read input file");
+			lzw_sample(&b, est, &ratio[n], &cost[n], &sl);
+		}
+	}
+
+	/* Sample from the start, maybe all of it. */
+	else
+	{
+		int ch;
+
+		if (end >= start)
+			fseek(input, start, SEEK_SET);
+
+		while (n < ESTIMATE_WINDOWS)
+		{
+			b.n = fread(b.in, 1, ESTIMATE_WINDOW, input);
+			if (b.n == 0)
+				break;
+			lzw_sample(&b, est, &ratio[n], &cost[n], &sl);
+			n++;
+		}
+
+		/* Nothing left, the sample is the whole input. */
+		if ((ch = fgetc(input)) == EOF)
+			est->size = est->sampled;
+		else
+			ungetc(ch, input);
+	}
+
+	if (end >= start)
+		fseek(input, start, SEEK_SET);
+
+	if (est->sampled == 0)
+		return;
+
+	/* Sums so far, now point estimates. */
+	est->speed = (est->speed > 0) ? est->sampled/est->speed : INFINITY;
+	est->ratio /= est->sampled;
+
+	/* Ratio, shrinking to a point as the sample covers the input. */
+	fpc = (est->size > 0) ? sqrt(1 - (double) est->sampled/est->size) : 1;
+	half = lzw_interval(ratio, n, fpc);
+	est->ratio_lo = (est->ratio > half) ? est->ratio - half : 0;
+	est->ratio_hi = est->ratio + half;
+
+	/* Stream overhead, known once the input size is. */
+	if (est->size > 0)
+	{
+		double overhead = (double) lzw_overhead(s, flags)/est->size;
+
+		est->ratio += overhead;
+		est->ratio_lo += overhead;
+		est->ratio_hi += overhead;
+	}
+
+	if (sl.len > 0)
+		s->pace = lzw_pace(s, &sl, flags);
+
+	/*
+	 * Throughput, at the pace of the session pipeline, spread as
+	 * much as the time taken per byte across windows.
+	 */
+	half = lzw_interval(cost, n, 1)*est->speed;
+	est->speed /= s->pace;
+	est->speed_lo = est->speed/(1 + half);
+	est->speed_hi = (half < 1) ? est->speed/(1 - half) : INFINITY;
+}
+
+/*
+ * Searches a compressed file for a pattern within a codec session,
+ * without decompressing it. Calls back with the offset of each match
+ * in the decompressed data, overlapping ones included, in order, and
+ * returns how many there were.
+ *
+ * Checksums are not verified. Chunk references of deduplicated
+ * streams point at earlier data, which then has to be expanded.
+ * Sessions with a thread pool search on the calling thread, others
+ * read the file on a thread of their own.
+ */
+uint64_t lzw_session_search(
+	struct lzw_session *s,
+	FILE *input,
+	const unsigned char *pat,
+	size_t len,
+	void (*match)(void *, uint64_t),
+	void *arg)
+{
+	searcher_t sr;
+	pthread_t reader;
+	uint64_t count;
+	int flags;
+
+	s->input = input;
+	s->output = NULL;
+	s->resume = NULL;
+	s->trail = NULL;
+	s->ckpt = NULL;
+	s->offset = 0;
+	s->dedup = NULL;
+	s->history = NULL;
+
+	arena_reset(s->arena);
+
+	flags = lzw_readheader(input, &s->opts);
+
+	s->control = (flags != 0);
+	s->first = (s->control) ? RADIX + NCONTROL : RADIX + 1;
+	s->crc = (flags & (HEADER_CRC | HEADER_MEMBER)) != 0;
+	s->entropy = (flags & HEADER_ENTROPY) != 0;
+
+	/* Members may only continue earlier ones. */
+	if (flags & HEADER_CONTINUE)
+		error("broken file");
+
+	lzw_reserve(s, ((lzw_pooled(&s->opts)) ? 0 : buffer_footprint(BUFFER_SIZE)) +
+		((flags & HEADER_DEDUP) ? history_footprint(DEDUP_WINDOW) : 0));
+
+	if (flags & HEADER_DEDUP)
+		s->history = history_create(DEDUP_WINDOW, s->arena);
+
+	sr = searcher_create(pat, len, s->opts.dict, s->first, s->history, match, arg);
+
+	if (lzw_pooled(&s->opts))
+		lzw_inline_search(s, sr);
+
+	else
+	{
+		s->inbuf = buffer_create(BUFFER_SIZE, s->arena);
+
+		pthread_create(&reader, NULL,
+			(s->entropy) ? lzw_readsymbols : lzw_readbits,
+			s
+		);
+
+		lzw_search_codes(s, sr);
+
+		pthread_join(reader, NULL);
+
+		buffer_destroy(s->inbuf);
+	}
+
+	count = searcher_count(sr);
+	searcher_destroy(sr);
+	lzw_dedup_end(s);
+
+	return (count);
+}
+
+/*
+ * Compress/Decompress a file using the LZW algorithm.
+ */
+void lzw(FILE *input, FILE *output, int compress, const struct lzw_options *opts)
+{
+	struct lzw_session *s;
+
+	s = lzw_session_create(opts);
+	lzw_session_run(s, input, output, compress);
+	lzw_session_destroy(s);
+}
+
+/*
+ * Estimates how well a file compresses with the LZW algorithm.
+ */
+void lzw_estimate(FILE *input, const struct lzw_options *opts, struct lzw_estimate *est)
+{
+	struct lzw_session *s;
+
+	s = lzw_session_create(opts);
+	lzw_session_estimate(s, input, est);
+	lzw_session_destroy(s);
+}
+
+/*
+ * Searches a file compressed with the LZW algorithm for a pattern.
+ */
+uint64_t lzw_search(
+	FILE *input,
+	const unsigned char *pat,
+	size_t len,
+	const struct lzw_options *opts,
+	void (*match)(void *, uint64_t),
+	void *arg)
+{
+	struct lzw_session *s;
+	uint64_t count;
+
+	s = lzw_session_create(opts);
+	count = lzw_session_search(s, input, pat, len, match, arg);
+	lzw_session_destroy(s);
+
+	return (count);
 }
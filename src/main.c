@@ -17,15 +17,75 @@
  * along with compress. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <global.h>
+#include <shdict.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <util.h>
 
+/*
+ * Maximum number of entries in a trained dictionary. Half of the
+ * code space is left for strings learned while compressing.
+ */
+#define TRAIN_MAX_ENTRIES 2048
+
 /* Command line arguments. */
-static int compress = 1; /* Compress?         */
-char *infile = NULL;     /* Input file name.  */
-char *outfile = NULL;    /* Output file name. */
+static int compress = 1;         /* Compress?         */
+static int train = 0;            /* Train?            */
+static int sync = 0;             /* Sync flushes?     */
+static unsigned flush_bytes = 0; /* Flush size.       */
+static unsigned flush_idle = 0;  /* Flush timeout.    */
+static size_t memory = 0;        /* Memory budget.    */
+static int jobs = -1;            /* Pool workers.     */
+static int verify = 0;           /* Verify output?    */
+static int store = 0;            /* Store raw data?   */
+static int crc = 0;              /* Checksums?        */
+static int append = 0;           /* Append?           */
+static size_t checkpoint = 0;    /* Checkpoint size.  */
+static int resume = 0;           /* Resume?           */
+static int dedup = 0;            /* Deduplicate?      */
+static int entropy = 0;          /* Entropy coding?   */
+static int estimate = 0;         /* Estimate?         */
+char *pattern = NULL;            /* Search pattern.   */
+char *infile = NULL;             /* Input file name.  */
+char *outfile = NULL;            /* Output file name. */
+char *dictfile = NULL;           /* Dictionary file.  */
+char *affinity = NULL;           /* Thread placement. */
+
+/*
+ * Long options.
+ */
+static const struct
+{
+	const char *name; /* Long name.  */
+	char opt;         /* Short name. */
+} longopts[] = {
+	{ "--create",      'c' },
+	{ "--extract",     'x' },
+	{ "--train",       't' },
+	{ "--dictionary",  'd' },
+	{ "--sync",        's' },
+	{ "--flush-bytes", 'b' },
+	{ "--flush-idle",  'i' },
+	{ "--memory",      'm' },
+	{ "--affinity",    'a' },
+	{ "--jobs",        'j' },
+	{ "--verify",      'v' },
+	{ "--store",       'r' },
+	{ "--checksum",    'k' },
+	{ "--append",      'A' },
+	{ "--checkpoint",  'C' },
+	{ "--resume",      'R' },
+	{ "--dedup",       'D' },
+	{ "--entropy",     'e' },
+	{ "--estimate",    'E' },
+	{ "--search",      'S' },
+	{ NULL,            0   }
+};
 
 /*
  * Prints program usage and exits.
@@ -37,10 +97,63 @@ static void usage(void)
 	printf("Options:\n");
 	printf("  -c, --create  Create a new archive\n");
 	printf("  -x, --extract Extract file from archive\n");
+	printf("  -t, --train   Train a dictionary on a sample corpus\n");
+	printf("                and save it to the output file\n");
+	printf("  -d, --dictionary <file>\n");
+	printf("                Use a trained dictionary\n");
+	printf("  -s, --sync    Allow sync flushes, requested with SIGUSR1\n");
+	printf("  -b, --flush-bytes <n>\n");
+	printf("                Sync flush every n input bytes\n");
+	printf("  -i, --flush-idle <ms>\n");
+	printf("                Sync flush when input is idle for ms\n");
+	printf("  -m, --memory <bytes>\n");
+	printf("                Codec memory budget\n");
+	printf("  -a, --affinity <auto|none|node=n|cpu,cpu,cpu>\n");
+	printf("                Placement of reader, codec and writer threads\n");
+	printf("  -j, --jobs <n> Compress blocks in parallel on n threads\n");
+	printf("                (0: one per available CPU), not with sync\n");
+	printf("                flushes or deduplication\n");
+	printf("  -v, --verify  Decode output while compressing and fail\n");
+	printf("                if it does not match the input\n");
+	printf("  -r, --store   Store incompressible data uncompressed\n");
+	printf("  -k, --checksum\n");
+	printf("                Add CRC-32C checksums to the archive\n");
+	printf("  -A, --append  Append to an existing archive, resuming its\n");
+	printf("                dictionary from <output file>.state\n");
+	printf("  -C, --checkpoint <bytes>\n");
+	printf("                Save a checkpoint to <output file>.ckpt\n");
+	printf("                every so many input bytes\n");
+	printf("  -R, --resume  Resume an interrupted compression from its\n");
+	printf("                last checkpoint\n");
+	printf("  -D, --dedup   Replace repeated chunks of input with\n");
+	printf("                references to their last copy\n");
+	printf("  -e, --entropy Entropy code the output with per-block\n");
+	printf("                Huffman tables\n");
+	printf("  -E, --estimate Estimate compression ratio and throughput\n");
+	printf("                from samples of the input, without writing\n");
+	printf("                an archive\n");
+	printf("  -S, --search <pattern>\n");
+	printf("                Print the offsets of a pattern in the\n");
+	printf("                decompressed data, without decompressing\n");
+	printf("\nUse - as file name for standard input or output.\n");
 	
 	exit(EXIT_SUCCESS);
 }
 
+/*
+ * Translates a long option into its short name.
+ */
+static char longopt(const char *arg)
+{
+	for (int i = 0; longopts[i].name != NULL; i++)
+	{
+		if (!strcmp(arg, longopts[i].name))
+			return (longopts[i].opt);
+	}
+	
+	return (0);
+}
+
 /*
  * Reads command line arguments.
  */
@@ -54,9 +167,9 @@ static void readargs(int argc, char **argv)
 		arg = argv[i];
 		
 		/* Parse option. */
-		if (arg[0] == '-')
+		if ((arg[0] == '-') && (arg[1] != '\0'))
 		{
-			switch (arg[1])
+			switch ((arg[1] == '-') ? longopt(arg) : arg[1])
 			{
 				/* Compress. */
 				case 'c':
@@ -67,6 +180,112 @@ static void readargs(int argc, char **argv)
 				case 'x':
 					compress = 0;
 					break;
+				
+				/* Train dictionary. */
+				case 't':
+					train = 1;
+					break;
+				
+				/* Shared dictionary. */
+				case 'd':
+					if (++i >= argc)
+						usage();
+					dictfile = argv[i];
+					break;
+				
+				/* Sync flushes. */
+				case 's':
+					sync = 1;
+					break;
+				
+				/* Flush size. */
+				case 'b':
+					if (++i >= argc)
+						usage();
+					flush_bytes = strtoul(argv[i], NULL, 10);
+					break;
+				
+				/* Flush timeout. */
+				case 'i':
+					if (++i >= argc)
+						usage();
+					flush_idle = strtoul(argv[i], NULL, 10);
+					break;
+				
+				/* Memory budget. */
+				case 'm':
+					if (++i >= argc)
+						usage();
+					memory = strtoul(argv[i], NULL, 10);
+					break;
+				
+				/* Thread placement. */
+				case 'a':
+					if (++i >= argc)
+						usage();
+					affinity = argv[i];
+					break;
+				
+				/* Pool workers. */
+				case 'j':
+					if (++i >= argc)
+						usage();
+					jobs = atoi(argv[i]);
+					break;
+				
+				/* Round-trip verification. */
+				case 'v':
+					verify = 1;
+					break;
+				
+				/* Stored segments. */
+				case 'r':
+					store = 1;
+					break;
+				
+				/* Checksums. */
+				case 'k':
+					crc = 1;
+					break;
+				
+				/* Append mode. */
+				case 'A':
+					append = 1;
+					break;
+				
+				/* Checkpoint size. */
+				case 'C':
+					if (++i >= argc)
+						usage();
+					checkpoint = strtoul(argv[i], NULL, 10);
+					break;
+				
+				/* Resume. */
+				case 'R':
+					resume = 1;
+					break;
+				
+				/* Deduplication. */
+				case 'D':
+					dedup = 1;
+					break;
+				
+				/* Entropy coding. */
+				case 'e':
+					entropy = 1;
+					break;
+				
+				/* Estimate mode. */
+				case 'E':
+					estimate = 1;
+					break;
+				
+				/* Search mode. */
+				case 'S':
+					if (++i >= argc)
+						usage();
+					pattern = argv[i];
+					break;
 			}
 		}
 		
@@ -87,10 +306,32 @@ static void readargs(int argc, char **argv)
 	}
 	
 	/* Missing output file. */
-	if (outfile == NULL)
+	if ((outfile == NULL) && (!estimate) && (pattern == NULL))
 		warning("missing output file");
 }
 
+/*
+ * Prints the offset of a match.
+ */
+static void onmatch(void *arg, uint64_t offset)
+{
+	fprintf(arg, "%llu\n", (unsigned long long) offset);
+}
+
+/* Running codec session. */
+static lzw_session_t session = NULL;
+
+/*
+ * Requests a sync flush.
+ */
+static void onflush(int sig)
+{
+	((void) sig);
+	
+	if (session != NULL)
+		lzw_session_flush(session);
+}
+
 /*
  * Usage: compress [options] <input file> <output file>
  *
@@ -99,29 +340,193 @@ static void readargs(int argc, char **argv)
  * Options:
  *     -c, --create  Create a new archive.
  *     -x, --extract Extract file from archive.
+ *     -t, --train   Train a dictionary on a sample corpus.
+ *     -d, --dictionary <file> Use a trained dictionary.
+ *     -s, --sync    Allow sync flushes, requested with SIGUSR1.
+ *     -b, --flush-bytes <n> Sync flush every n input bytes.
+ *     -i, --flush-idle <ms> Sync flush when input is idle for ms.
+ *     -m, --memory <bytes> Codec memory budget.
+ *     -a, --affinity <auto|none|node=n|cpu,cpu,cpu> Thread placement.
+ *     -j, --jobs <n> Compress blocks in parallel on n threads.
+ *     -v, --verify  Decode output while compressing.
+ *     -r, --store   Store incompressible data uncompressed.
+ *     -k, --checksum Add CRC-32C checksums to the archive.
+ *     -A, --append  Append to an existing archive.
+ *     -C, --checkpoint <bytes> Save a checkpoint every so many input bytes.
+ *     -R, --resume  Resume from the last checkpoint.
+ *     -D, --dedup   Replace repeated chunks with references.
+ *     -e, --entropy Entropy code the output.
+ *     -E, --estimate Estimate compression ratio and throughput.
+ *     -S, --search <pattern> Print the offsets of a pattern.
  */
 int main(int argc, char **argv)
 {
 	FILE *input;  /* Input file.  */
 	FILE *output; /* Output file. */
+	struct lzw_options opts;
 	
 	readargs(argc, argv);
 	
 	/* Open input file. */
-	input = fopen(infile, "r");
+	input = (!strcmp(infile, "-")) ? stdin : fopen(infile, "r");
 	if (input == NULL)
 		error("cannot open input file");
 	
+	/* Train mode. */
+	if (train)
+	{
+		shdict_t dict;
+		
+		dict = shdict_train(input, 256, TRAIN_MAX_ENTRIES);
+		shdict_save(dict, outfile);
+		
+		/* House keeping. */
+		shdict_destroy(dict);
+		fclose(input);
+		
+		return (EXIT_SUCCESS);
+	}
+	
+	opts.dict = (dictfile != NULL) ? shdict_load(dictfile) : NULL;
+	
+	opts.sync = sync;
+	opts.flush_bytes = flush_bytes;
+	opts.flush_idle = flush_idle;
+	opts.memory = memory;
+	opts.affinity = affinity;
+	opts.pool = (jobs >= 0) ? pool_create(jobs, affinity) : NULL;
+	opts.block_size = 0;
+	opts.verify = verify;
+	opts.store = store;
+	opts.crc = crc;
+	opts.append = (compress && append);
+	opts.state = NULL;
+	opts.checkpoint = (compress) ? checkpoint : 0;
+	opts.ckpt = NULL;
+	opts.resume = (compress && resume);
+	opts.dedup = dedup;
+	opts.entropy = entropy;
+	
+	/* Search mode. */
+	if (pattern != NULL)
+	{
+		opts.append = 0;
+		opts.checkpoint = 0;
+		opts.resume = 0;
+		
+		output = ((outfile == NULL) || (!strcmp(outfile, "-"))) ?
+			stdout : fopen(outfile, "w");
+		if (output == NULL)
+			error("cannot open output file");
+		
+		lzw_search(input, (unsigned char *) pattern, strlen(pattern),
+			&opts, onmatch, output);
+		
+		/* House keeping. */
+		if (opts.pool != NULL)
+			pool_destroy(opts.pool);
+		if (opts.dict != NULL)
+			shdict_destroy(opts.dict);
+		fclose(input);
+		if (fclose(output) != 0)
+			error("cannot write output file");
+		
+		return (EXIT_SUCCESS);
+	}
+	
+	/* Estimate mode. */
+	if (estimate)
+	{
+		struct lzw_estimate est;
+		
+		opts.append = 0;
+		opts.checkpoint = 0;
+		opts.resume = 0;
+		
+		lzw_estimate(input, &opts, &est);
+		
+		printf("ratio:      %.4f (%.4f to %.4f)\n",
+			est.ratio, est.ratio_lo, est.ratio_hi);
+		printf("throughput: %.1f MB/s (%.1f to %.1f)\n",
+			est.speed/1e6, est.speed_lo/1e6, est.speed_hi/1e6);
+		if (est.jobs > 0)
+			printf("mode:       pool of %u workers\n", est.jobs);
+		else
+			printf("mode:       threaded pipeline\n");
+		if (est.size > 0)
+			printf("sampled:    %zu of %zu bytes\n", est.sampled, est.size);
+		else
+			printf("sampled:    %zu bytes\n", est.sampled);
+		
+		/* House keeping. */
+		if (opts.pool != NULL)
+			pool_destroy(opts.pool);
+		if (opts.dict != NULL)
+			shdict_destroy(opts.dict);
+		fclose(input);
+		
+		return (EXIT_SUCCESS);
+	}
+	
+	/* Dictionary state lives next to the archive. */
+	if (opts.append)
+	{
+		char *state;
+		
+		if (!strcmp(outfile, "-"))
+			error("cannot append to standard output");
+		
+		state = smalloc(strlen(outfile) + sizeof(".state"));
+		strcpy(state, outfile);
+		strcat(state, ".state");
+		opts.state = state;
+	}
+	
+	/* Checkpoints live next to the archive. */
+	if ((opts.checkpoint > 0) || (opts.resume))
+	{
+		char *ckpt;
+		
+		if (!strcmp(outfile, "-"))
+			error("cannot checkpoint standard output");
+		
+		ckpt = smalloc(strlen(outfile) + sizeof(".ckpt"));
+		strcpy(ckpt, outfile);
+		strcat(ckpt, ".ckpt");
+		opts.ckpt = ckpt;
+	}
+	
+	session = lzw_session_create(&opts);
+	
+	/* Explicit sync flushes. */
+	if (sync)
+		signal(SIGUSR1, onflush);
+	
 	/* Open output file. */
-	output = fopen(outfile, "w");
+	if ((opts.append) || (opts.resume))
+	{
+		output = fopen(outfile, "r+b");
+		if (output == NULL)
+			output = fopen(outfile, "w+b");
+	}
+	else
+		output = (!strcmp(outfile, "-")) ? stdout : fopen(outfile, "w");
 	if (output == NULL)
 		error("cannot open output file");
 
-	lzw(input, output, compress);
+	lzw_session_run(session, input, output, compress);
 
 	/* House keeping. */
+	lzw_session_destroy(session);
+	if (opts.pool != NULL)
+		pool_destroy(opts.pool);
+	if (opts.dict != NULL)
+		shdict_destroy(opts.dict);
+	free((char *) opts.state);
+	free((char *) opts.ckpt);
 	fclose(input);
-	fclose(output);
+	if (fclose(output) != 0)
+		error("cannot write output file");
 	
 	return (EXIT_SUCCESS);
 }
@@ -0,0 +1,578 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <affinity.h>
+#include <arena.h>
+#include <assert.h>
+#include <pool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <util.h>
+
+/*
+ * Parameters.
+ */
+#define DEQUE_SIZE 64      /* Initial deque capacity.            */
+#define HELP_WAIT  1000000 /* Helper sleep between checks (ns).  */
+
+/*
+ * Task.
+ */
+struct task
+{
+	void (*run)(void *);      /* Task function.   */
+	void *arg;                /* Task argument.   */
+	struct pool_batch *batch; /* Owner batch.     */
+	unsigned seq;             /* Sequence number. */
+};
+
+/*
+ * Double-ended task queue. The owner works at the bottom,
+ * thieves take from the top.
+ */
+struct deque
+{
+	struct task *tasks;    /* Tasks (circular).  */
+	unsigned size;         /* Capacity.          */
+	unsigned top;          /* Oldest task.       */
+	unsigned bottom;       /* Past newest task.  */
+	pthread_mutex_t mutex; /* Deque lock.        */
+};
+
+/*
+ * Worker.
+ */
+struct worker
+{
+	struct pool *pool; /* Pool.         */
+	int id;            /* Worker index. */
+	pthread_t thread;  /* Thread.       */
+};
+
+/*
+ * Thread pool.
+ */
+struct pool
+{
+	int nworkers;           /* Number of workers.         */
+	struct worker *workers; /* Workers.                   */
+	affinity_t affinity;    /* Worker placement.          */
+	struct deque *deques;   /* One deque per worker.      */
+	unsigned next;          /* Round-robin for outsiders. */
+	unsigned pending;       /* Queued tasks.              */
+	int shutdown;           /* Shutting down?             */
+	pthread_mutex_t mutex;  /* Pool lock.                 */
+	pthread_cond_t wakeup;  /* Signals new work.          */
+};
+
+/*
+ * Batch of ordered tasks.
+ */
+struct pool_batch
+{
+	struct pool *pool;        /* Pool.                      */
+	void (*complete)(void *); /* Completion callback.       */
+	unsigned window;          /* Maximum tasks in flight.   */
+	void **args;              /* Task arguments (circular). */
+	char *done;               /* Finished? (circular).      */
+	unsigned submitted;       /* Tasks submitted.           */
+	unsigned completed;       /* Tasks completed, in order. */
+	int draining;             /* Completing tasks?          */
+	arena_t arena;            /* Backing arena (or NULL).   */
+	pthread_mutex_t mutex;    /* Batch lock.                */
+	pthread_cond_t progress;  /* Signals completions.       */
+};
+
+/*
+ * Worker that runs the calling thread (NULL if none).
+ */
+static _Thread_local struct worker *self = NULL;
+
+/*============================================================================*
+ *                                   Deques                                   *
+ *============================================================================*/
+
+/*
+ * Pushes a task at the bottom of a deque.
+ */
+static void deque_push(struct deque *dq, const struct task *t)
+{
+	pthread_mutex_lock(&dq->mutex);
+
+	/* Grow deque. */
+	if (dq->bottom - dq->top == dq->size)
+	{
+		struct task *tasks = smalloc(2*dq->size*sizeof(struct task));
+
+		for (unsigned i = 0; i < dq->size; i++)
+			tasks[i] = dq->tasks[(dq->top + i) % dq->size];
+
+		free(dq->tasks);
+		dq->tasks = tasks;
+		dq->bottom -= dq->top;
+		dq->top = 0;
+		dq->size *= 2;
+	}
+
+	dq->tasks[dq->bottom++ % dq->size] = *t;
+
+	pthread_mutex_unlock(&dq->mutex);
+}
+
+/*
+ * Pops the newest task of a deque. Returns zero if empty.
+ */
+static int deque_pop(struct deque *dq, struct task *t)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&dq->mutex);
+
+	if (dq->bottom != dq->top)
+	{
+		*t = dq->tasks[--dq->bottom % dq->size];
+		found = 1;
+	}
+
+	pthread_mutex_unlock(&dq->mutex);
+
+	return (found);
+}
+
+/*
+ * Steals the oldest task of a deque. Returns zero if empty.
+ */
+static int deque_steal(struct deque *dq, struct task *t)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&dq->mutex);
+
+	if (dq->bottom != dq->top)
+	{
+		*t = dq->tasks[dq->top++ % dq->size];
+		found = 1;
+	}
+
+	pthread_mutex_unlock(&dq->mutex);
+
+	return (found);
+}
+
+/*============================================================================*
+ *                                  Batches                                   *
+ *============================================================================*/
+
+static int pool_help(struct pool *);
+
+/*
+ * Marks a task as finished and completes, in submission
+ * order, every task that is ready. Only one thread at a
+ * time runs completion callbacks.
+ */
+static void pool_batch_finish(struct pool_batch *b, unsigned seq)
+{
+	pthread_mutex_lock(&b->mutex);
+
+	b->done[seq % b->window] = 1;
+
+	if (!b->draining)
+	{
+		b->draining = 1;
+
+		while ((b->completed != b->submitted) &&
+			(b->done[b->completed % b->window]))
+		{
+			void *arg = b->args[b->completed % b->window];
+
+			b->done[b->completed % b->window] = 0;
+
+			pthread_mutex_unlock(&b->mutex);
+			if (b->complete != NULL)
+				b->complete(arg);
+			pthread_mutex_lock(&b->mutex);
+
+			b->completed++;
+			pthread_cond_broadcast(&b->progress);
+		}
+
+		b->draining = 0;
+	}
+
+	pthread_mutex_unlock(&b->mutex);
+}
+
+/*
+ * Memory used by a batch carved from an arena.
+ */
+size_t pool_batch_footprint(unsigned window)
+{
+	return (sizeof(struct pool_batch) + window*(sizeof(void *) + 1) + 3*64);
+}
+
+/*
+ * Creates a batch with at most window tasks in flight,
+ * carved from an arena if one is given.
+ */
+struct pool_batch *pool_batch_create(
+	struct pool *pool,
+	unsigned window,
+	void (*complete)(void *),
+	arena_t arena)
+{
+	struct pool_batch *b;
+
+	/* Sanity check. */
+	assert(pool != NULL);
+	assert(window > 0);
+
+	if (arena != NULL)
+	{
+		b = arena_alloc(arena, sizeof(struct pool_batch));
+		b->args = arena_alloc(arena, window*sizeof(void *));
+		b->done = arena_alloc(arena, window*sizeof(char));
+	}
+	else
+	{
+		b = smalloc(sizeof(struct pool_batch));
+		b->args = smalloc(window*sizeof(void *));
+		b->done = smalloc(window*sizeof(char));
+	}
+
+	/* Initialize batch. */
+	b->pool = pool;
+	b->complete = complete;
+	b->window = window;
+	b->arena = arena;
+	b->submitted = 0;
+	b->completed = 0;
+	b->draining = 0;
+	for (unsigned i = 0; i < window; i++)
+		b->done[i] = 0;
+
+	pthread_mutex_init(&b->mutex, NULL);
+	pthread_cond_init(&b->progress, NULL);
+
+	return (b);
+}
+
+/*
+ * Destroys a batch. All of its tasks must have completed.
+ */
+void pool_batch_destroy(struct pool_batch *b)
+{
+	/* Sanity check. */
+	assert(b != NULL);
+
+	pool_batch_wait(b, 0);
+
+	pthread_cond_destroy(&b->progress);
+	pthread_mutex_destroy(&b->mutex);
+
+	/* Arena memory is released with the arena. */
+	if (b->arena == NULL)
+	{
+		free(b->done);
+		free(b->args);
+		free(b);
+	}
+}
+
+/*
+ * Waits until at most n tasks of a batch are in flight.
+ *
+ * Workers of the batch's pool run queued tasks while they wait, so
+ * that tasks which themselves wait on the pool, such as sessions
+ * sharing it, cannot take every worker out and deadlock. Tasks may
+ * be queued without the batch being told, so helpers only sleep
+ * for a while between checks.
+ */
+void pool_batch_wait(struct pool_batch *b, unsigned n)
+{
+	int helper;
+
+	/* Sanity check. */
+	assert(b != NULL);
+
+	helper = (self != NULL) && (self->pool == b->pool);
+
+	pthread_mutex_lock(&b->mutex);
+
+	while (b->submitted - b->completed > n)
+	{
+		struct timespec ts;
+
+		if (!helper)
+		{
+			pthread_cond_wait(&b->progress, &b->mutex);
+			continue;
+		}
+
+		pthread_mutex_unlock(&b->mutex);
+		if (pool_help(b->pool))
+		{
+			pthread_mutex_lock(&b->mutex);
+			continue;
+		}
+		pthread_mutex_lock(&b->mutex);
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += HELP_WAIT;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+
+		if (b->submitted - b->completed > n)
+			pthread_cond_timedwait(&b->progress, &b->mutex, &ts);
+	}
+
+	pthread_mutex_unlock(&b->mutex);
+}
+
+/*
+ * Submits a task to a batch, blocking while the batch window is full.
+ *
+ * Tasks submitted by a pool worker go to its own deque, others are
+ * spread over all workers.
+ */
+void pool_batch_submit(struct pool_batch *b, void (*run)(void *), void *arg)
+{
+	struct pool *pool;
+	struct task t;
+	int id;
+
+	/* Sanity check. */
+	assert(b != NULL);
+	assert(run != NULL);
+
+	pool = b->pool;
+
+	pool_batch_wait(b, b->window - 1);
+
+	pthread_mutex_lock(&b->mutex);
+	t.run = run;
+	t.arg = arg;
+	t.batch = b;
+	t.seq = b->submitted++;
+	b->args[t.seq % b->window] = arg;
+	pthread_mutex_unlock(&b->mutex);
+
+	pthread_mutex_lock(&pool->mutex);
+	id = ((self != NULL) && (self->pool == pool)) ?
+		self->id : (int)(pool->next++ % pool->nworkers);
+	pthread_mutex_unlock(&pool->mutex);
+
+	deque_push(&pool->deques[id], &t);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->pending++;
+	pthread_cond_signal(&pool->wakeup);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/*============================================================================*
+ *                                  Workers                                   *
+ *============================================================================*/
+
+/*
+ * Takes a task: own deque first, then steal from the others.
+ */
+static int pool_take(struct pool *pool, int id, struct task *t)
+{
+	if (deque_pop(&pool->deques[id], t))
+		return (1);
+
+	for (int k = 1; k < pool->nworkers; k++)
+	{
+		if (deque_steal(&pool->deques[(id + k) % pool->nworkers], t))
+			return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * Runs a task that was reserved by decrementing the pending count.
+ */
+static void pool_run(struct pool *pool)
+{
+	struct task t;
+
+	/*
+	 * A task is queued somewhere and reserved for us,
+	 * but another worker may be pushing it right now.
+	 */
+	while (!pool_take(pool, self->id, &t))
+		sched_yield();
+
+	t.run(t.arg);
+	pool_batch_finish(t.batch, t.seq);
+}
+
+/*
+ * Runs a queued task, if any, on behalf of a waiting worker.
+ * Returns zero if there was none.
+ */
+static int pool_help(struct pool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+
+	if (pool->pending == 0)
+	{
+		pthread_mutex_unlock(&pool->mutex);
+		return (0);
+	}
+
+	pool->pending--;
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	pool_run(pool);
+
+	return (1);
+}
+
+/*
+ * Worker thread.
+ */
+static void *pool_worker(void *arg)
+{
+	struct pool *pool;
+
+	self = arg;
+	pool = self->pool;
+
+	affinity_pool(pool->affinity, self->id);
+
+	while (1)
+	{
+		pthread_mutex_lock(&pool->mutex);
+
+		while ((pool->pending == 0) && (!pool->shutdown))
+			pthread_cond_wait(&pool->wakeup, &pool->mutex);
+
+		if (pool->pending == 0)
+		{
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+
+		pool->pending--;
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		pool_run(pool);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Creates a thread pool. With zero workers, one worker per CPU the
+ * process may use is started, honoring affinity masks and cgroup
+ * CPU quotas. Workers are placed as sessions are (see affinity.c).
+ */
+struct pool *pool_create(int nworkers, const char *placement)
+{
+	struct pool *pool;
+
+	if (nworkers <= 0)
+		nworkers = affinity_ncpus();
+
+	pool = smalloc(sizeof(struct pool));
+
+	/* Initialize pool. */
+	pool->nworkers = nworkers;
+	pool->workers = smalloc(nworkers*sizeof(struct worker));
+	pool->affinity = affinity_create(placement);
+	pool->deques = smalloc(nworkers*sizeof(struct deque));
+	pool->next = 0;
+	pool->pending = 0;
+	pool->shutdown = 0;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->wakeup, NULL);
+
+	for (int i = 0; i < nworkers; i++)
+	{
+		struct deque *dq = &pool->deques[i];
+
+		dq->size = DEQUE_SIZE;
+		dq->tasks = smalloc(DEQUE_SIZE*sizeof(struct task));
+		dq->top = 0;
+		dq->bottom = 0;
+		pthread_mutex_init(&dq->mutex, NULL);
+
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+	}
+
+	for (int i = 0; i < nworkers; i++)
+	{
+		struct worker *w = &pool->workers[i];
+
+		pthread_create(&w->thread, NULL, pool_worker, w);
+	}
+
+	return (pool);
+}
+
+/*
+ * Destroys a thread pool, after running all queued tasks.
+ */
+void pool_destroy(struct pool *pool)
+{
+	/* Sanity check. */
+	assert(pool != NULL);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->wakeup);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (int i = 0; i < pool->nworkers; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	for (int i = 0; i < pool->nworkers; i++)
+	{
+		pthread_mutex_destroy(&pool->deques[i].mutex);
+		free(pool->deques[i].tasks);
+	}
+
+	pthread_cond_destroy(&pool->wakeup);
+	pthread_mutex_destroy(&pool->mutex);
+
+	affinity_destroy(pool->affinity);
+	free(pool->deques);
+	free(pool->workers);
+	free(pool);
+}
+
+/*
+ * Returns the number of workers in a pool.
+ */
+int pool_workers(struct pool *pool)
+{
+	return (pool->nworkers);
+}
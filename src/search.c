@@ -0,0 +1,398 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dedup.h>
+#include <dictionary.h>
+#include <search.h>
+#include <shdict.h>
+#include <stdint.h>
+#include <stream.h>
+#include <string.h>
+#include <strtab.h>
+#include <util.h>
+
+/*
+ * Search parameters.
+ */
+#define SEARCH_MAX 1024 /* Longest pattern (bytes). */
+
+/*
+ * Compressed-domain searcher.
+ *
+ * Follows the string table of the decoder, but instead of expanding
+ * strings it keeps, for each entry, how its string relates to the
+ * pattern: the matcher state after reading it, its longest prefix
+ * that ends the pattern, where it first occurs in the pattern, and
+ * its longest prefix that ends with a match. Matches that start in
+ * earlier strings or lie within a string then come out of these
+ * alone, and only strings short enough to be part of the pattern
+ * are ever expanded.
+ *
+ * Tables grow with the square of the pattern length, so searchers
+ * are allocated on their own.
+ */
+struct searcher
+{
+	/* Pattern. */
+	unsigned char *pat;     /* Pattern.                            */
+	unsigned m;             /* Pattern length.                     */
+	unsigned short *dfa;    /* Matcher transitions.                */
+	unsigned short *fail;   /* Matcher failure links.              */
+	unsigned short *lcp;    /* Common prefixes of pattern suffixes. */
+
+	/* String table. */
+	struct strtab st;       /* String table.                       */
+	shdict_t shdict;        /* Shared dictionary.                  */
+	code_t first;           /* First free code.                    */
+	unsigned i;             /* Next code.                          */
+	unsigned prev;          /* Previous code.                      */
+	unsigned *len;          /* String length.                      */
+	unsigned char *head;    /* First character.                    */
+	unsigned short *state;  /* Matcher state after string.         */
+	unsigned short *pre;    /* Longest prefix ending the pattern.  */
+	int *occ;               /* First occurrence in pattern.        */
+	int *hit;               /* Longest prefix ending with a match. */
+	unsigned *hits;         /* Matches within a string.            */
+
+	/* Text. */
+	unsigned q;               /* Matcher state.                    */
+	uint64_t pos;             /* Text offset.                      */
+	uint64_t count;           /* Matches so far.                   */
+	struct history *history;  /* Recent text (may be NULL).        */
+
+	/* Match sink. */
+	void (*match)(void *, uint64_t);
+	void *arg;
+};
+
+/*
+ * Length of the common prefix of two suffixes of the pattern.
+ */
+#define LCP(sr, a, b) ((sr)->lcp[(a)*((sr)->m + 1) + (b)])
+
+/*
+ * Reports a match.
+ */
+static void searcher_report(struct searcher *sr, uint64_t offset)
+{
+	sr->count++;
+	sr->match(sr->arg, offset);
+}
+
+/*
+ * Works out how the string of an entry relates to the pattern,
+ * from what is known about its prefix.
+ */
+static void searcher_link(struct searcher *sr, unsigned e)
+{
+	int p = sr->st.parent[e];
+	unsigned c = sr->st.ch[e];
+	unsigned m = sr->m;
+
+	/* Single character. */
+	if (p < 0)
+	{
+		sr->len[e] = 1;
+		sr->head[e] = c;
+		sr->state[e] = sr->dfa[c];
+		sr->occ[e] = -1;
+		for (unsigned b = 0; b < m; b++)
+		{
+			if (sr->pat[b] == c)
+			{
+				sr->occ[e] = b;
+				break;
+			}
+		}
+		sr->pre[e] = (sr->pat[m - 1] == c);
+		sr->hit[e] = (sr->state[e] == m) ? (int) e : -1;
+		return;
+	}
+
+	sr->len[e] = sr->len[p] + 1;
+	sr->head[e] = sr->head[p];
+	sr->state[e] = sr->dfa[sr->state[p]*RADIX + c];
+	sr->hit[e] = (sr->state[e] == m) ? (int) e : sr->hit[p];
+
+	/* Next occurrence of the prefix that goes on with the character. */
+	sr->occ[e] = -1;
+	if (sr->occ[p] >= 0)
+	{
+		unsigned a = sr->occ[p];
+		unsigned n = sr->len[p];
+
+		for (unsigned b = a; b + n < m; b++)
+		{
+			if ((LCP(sr, a, b) >= n) && (sr->pat[b + n] == c))
+			{
+				sr->occ[e] = b;
+				break;
+			}
+		}
+	}
+
+	/* The whole string ends the pattern, or some prefix of it. */
+	if ((sr->occ[e] >= 0) && (LCP(sr, sr->occ[e], m - sr->len[e]) >= sr->len[e]))
+		sr->pre[e] = sr->len[e];
+	else
+		sr->pre[e] = sr->pre[p];
+}
+
+/*
+ * Resets a searcher's string table to the start of a stream.
+ */
+static void searcher_reset(struct searcher *sr)
+{
+	sr->i = strtab_init(&sr->st, RADIX, sr->first, sr->shdict);
+	sr->prev = EOF;
+
+	/* Shared dictionary. */
+	for (unsigned e = sr->first; e < sr->i; e++)
+		searcher_link(sr, e);
+}
+
+/*
+ * Creates a searcher for a pattern.
+ */
+struct searcher *searcher_create(
+	const unsigned char *pat,
+	size_t m,
+	shdict_t shdict,
+	code_t first,
+	struct history *history,
+	void (*match)(void *, uint64_t),
+	void *arg)
+{
+	struct searcher *sr;
+	unsigned x;
+	size_t size = (1 << WIDTH) + 2;
+
+	if ((m == 0) || (m > SEARCH_MAX))
+		error("bad search pattern");
+
+	sr = smalloc(sizeof(struct searcher));
+	sr->pat = smalloc(m);
+	sr->m = m;
+	sr->dfa = smalloc((m + 1)*RADIX*sizeof(unsigned short));
+	sr->fail = smalloc((m + 1)*sizeof(unsigned short));
+	sr->lcp = smalloc((m + 1)*(m + 1)*sizeof(unsigned short));
+	memcpy(sr->pat, pat, m);
+
+	/* Matcher, which goes on past a match. */
+	for (unsigned c = 0; c < RADIX; c++)
+		sr->dfa[c] = 0;
+	sr->dfa[pat[0]] = 1;
+	sr->fail[0] = 0;
+	x = 0;
+	for (unsigned q = 1; q <= m; q++)
+	{
+		sr->fail[q] = x;
+		memcpy(&sr->dfa[q*RADIX], &sr->dfa[x*RADIX], RADIX*sizeof(unsigned short));
+		if (q < m)
+		{
+			sr->dfa[q*RADIX + pat[q]] = q + 1;
+			x = sr->dfa[x*RADIX + pat[q]];
+		}
+	}
+
+	/* Common prefixes, from the end. */
+	for (int a = m; a >= 0; a--)
+	{
+		for (int b = m; b >= 0; b--)
+		{
+			LCP(sr, a, b) = ((a < (int) m) && (b < (int) m) && (pat[a] == pat[b])) ?
+				LCP(sr, a + 1, b + 1) + 1 : 0;
+		}
+	}
+
+	sr->st.parent = smalloc(size*sizeof(int));
+	sr->st.ch = smalloc(size*sizeof(unsigned char));
+	sr->st.buf = smalloc((1 << WIDTH)*sizeof(unsigned char));
+	sr->len = smalloc(size*sizeof(unsigned));
+	sr->head = smalloc(size*sizeof(unsigned char));
+	sr->state = smalloc(size*sizeof(unsigned short));
+	sr->pre = smalloc(size*sizeof(unsigned short));
+	sr->occ = smalloc(size*sizeof(int));
+	sr->hit = smalloc(size*sizeof(int));
+	sr->hits = smalloc((1 << WIDTH)*sizeof(unsigned));
+	sr->shdict = shdict;
+	sr->first = first;
+
+	/* Single characters never change. */
+	strtab_init(&sr->st, RADIX, sr->first, NULL);
+	for (unsigned e = 0; e < RADIX; e++)
+		searcher_link(sr, e);
+	searcher_reset(sr);
+
+	sr->q = 0;
+	sr->pos = 0;
+	sr->count = 0;
+	sr->history = history;
+	sr->match = match;
+	sr->arg = arg;
+
+	return (sr);
+}
+
+/*
+ * Destroys a searcher.
+ */
+void searcher_destroy(struct searcher *sr)
+{
+	free(sr->pat);
+	free(sr->dfa);
+	free(sr->fail);
+	free(sr->lcp);
+	free(sr->st.parent);
+	free(sr->st.ch);
+	free(sr->st.buf);
+	free(sr->len);
+	free(sr->head);
+	free(sr->state);
+	free(sr->pre);
+	free(sr->occ);
+	free(sr->hit);
+	free(sr->hits);
+	free(sr);
+}
+
+/*
+ * Searches plain text.
+ */
+void searcher_raw(struct searcher *sr, const unsigned char *data, size_t n)
+{
+	for (size_t k = 0; k < n; k++)
+	{
+		sr->q = sr->dfa[sr->q*RADIX + data[k]];
+		if (sr->q == sr->m)
+			searcher_report(sr, sr->pos + k + 1 - sr->m);
+	}
+
+	sr->pos += n;
+
+	if (sr->history != NULL)
+		history_put(sr->history, data, n);
+}
+
+/*
+ * Searches the string of an entry.
+ */
+static void searcher_string(struct searcher *sr, unsigned e)
+{
+	unsigned m = sr->m;
+	unsigned n = 0;
+
+	/*
+	 * Part of the pattern, or needed to resolve chunk
+	 * references later on: just expand it.
+	 */
+	if ((sr->occ[e] >= 0) || (sr->history != NULL))
+	{
+		unsigned j = strtab_expand(&sr->st, e);
+
+		searcher_raw(sr, &sr->st.buf[j], (1 << WIDTH) - j);
+		return;
+	}
+
+	/*
+	 * Matches that started earlier: the text so far ends with
+	 * some prefix of the pattern, and the string starts with
+	 * the rest of it.
+	 */
+	for (unsigned i = (sr->q == m) ? sr->fail[m] : sr->q; i > 0; i = sr->fail[i])
+	{
+		unsigned pre = sr->pre[e];
+
+		if ((m - i <= pre) && (LCP(sr, i, m - pre) >= m - i))
+			searcher_report(sr, sr->pos - i);
+	}
+
+	/* Matches within the string, found last to first. */
+	for (int h = sr->hit[e]; h >= 0; h = sr->hit[sr->st.parent[h]])
+	{
+		sr->hits[n++] = sr->len[h];
+		if (sr->st.parent[h] < 0)
+			break;
+	}
+	while (n > 0)
+		searcher_report(sr, sr->pos + sr->hits[--n] - m);
+
+	/*
+	 * No match runs past the end of a string that is not part
+	 * of the pattern, so the matcher state is that of the string.
+	 */
+	sr->q = sr->state[e];
+	sr->pos += sr->len[e];
+}
+
+/*
+ * Searches the string of a code.
+ */
+void searcher_put(struct searcher *sr, unsigned code)
+{
+	/* Reset symbol table. */
+	if ((code == CODE_RESET) || STORED(code))
+	{
+		searcher_reset(sr);
+		return;
+	}
+
+	/* Sync flush, checksum or reference. */
+	if ((code == TOKEN_FLUSH) || CHECKED(code) || (code == TOKEN_REF))
+	{
+		sr->prev = EOF;
+		return;
+	}
+
+	/* Broken file. */
+	if ((code >= RADIX) && (code < sr->first))
+		error("broken file");
+
+	/* First code. */
+	if (sr->prev == EOF)
+	{
+		/* Broken file. */
+		if (code >= sr->i)
+			error("broken file");
+	}
+
+	else
+	{
+		/* Broken file. */
+		if ((code > sr->i) || (sr->i > (1 << WIDTH)))
+			error("broken file");
+
+		/* Add previous string plus first character of the current one. */
+		sr->st.parent[sr->i] = sr->prev;
+		sr->st.ch[sr->i] = (code == sr->i) ? sr->head[sr->prev] : sr->head[code];
+		searcher_link(sr, sr->i++);
+	}
+
+	searcher_string(sr, code);
+
+	sr->prev = code;
+}
+
+/*
+ * Returns the number of matches reported so far.
+ */
+uint64_t searcher_count(struct searcher *sr)
+{
+	return (sr->count);
+}
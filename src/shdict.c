@@ -0,0 +1,327 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <dictionary.h>
+#include <shdict.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <util.h>
+
+/*
+ * Parameters.
+ */
+#define SHDICT_RADIX   256       /* Radix of trained data.        */
+#define SHDICT_NODES   (1 << 20) /* Maximum size of training trie. */
+#define SHDICT_VERSION '1'       /* File format version.          */
+
+/*============================================================================*
+ *                                  File I/O                                  *
+ *============================================================================*/
+
+/*
+ * Computes the ID of a shared dictionary (FNV-1a).
+ */
+static unsigned shdict_hash(struct shdict *dict)
+{
+	unsigned h = 2166136261u;
+
+	for (int i = 0; i < dict->nentries; i++)
+	{
+		h = (h ^ (dict->entries[i].parent & 0xff)) * 16777619u;
+		h = (h ^ (dict->entries[i].parent >> 8)) * 16777619u;
+		h = (h ^ dict->entries[i].ch) * 16777619u;
+	}
+
+	return (h);
+}
+
+/*
+ * Destroys a shared dictionary.
+ */
+void shdict_destroy(struct shdict *dict)
+{
+	/* Sanity check. */
+	assert(dict != NULL);
+
+	free(dict->entries);
+	free(dict);
+}
+
+/*
+ * Reads a shared dictionary from a stream.
+ */
+struct shdict *shdict_read(FILE *file)
+{
+	struct shdict *dict; /* Dictionary. */
+	int hi, lo;          /* Count bytes. */
+	int n;               /* Entries.    */
+
+	/* Bad magic. */
+	if ((fgetc(file) != 'L') || (fgetc(file) != 'Z') ||
+		(fgetc(file) != 'D') || (fgetc(file) != SHDICT_VERSION))
+		error("bad dictionary file");
+
+	hi = fgetc(file);
+	lo = fgetc(file);
+
+	/* Truncated file. */
+	if ((hi == EOF) || (lo == EOF))
+		error("bad dictionary file");
+
+	n = (hi << 8) | lo;
+
+	dict = smalloc(sizeof(struct shdict));
+	dict->nentries = n;
+	dict->entries = smalloc((n + 1)*sizeof(struct shdict_entry));
+
+	for (int i = 0; i < n; i++)
+	{
+		int hi, lo, ch;
+
+		hi = fgetc(file);
+		lo = fgetc(file);
+		ch = fgetc(file);
+
+		/* Truncated file. */
+		if ((hi == EOF) || (lo == EOF) || (ch == EOF))
+			error("bad dictionary file");
+
+		dict->entries[i].parent = (hi << 8) | lo;
+		dict->entries[i].ch = ch;
+
+		/* Parents must come first. */
+		if (dict->entries[i].parent >= (unsigned)(SHDICT_RADIX + i))
+			error("bad dictionary file");
+	}
+
+	dict->id = shdict_hash(dict);
+
+	return (dict);
+}
+
+/*
+ * Writes a shared dictionary to a stream.
+ */
+void shdict_write(struct shdict *dict, FILE *file)
+{
+	/* Sanity check. */
+	assert(dict != NULL);
+
+	fputc('L', file);
+	fputc('Z', file);
+	fputc('D', file);
+	fputc(SHDICT_VERSION, file);
+	fputc((dict->nentries >> 8) & 0xff, file);
+	fputc(dict->nentries & 0xff, file);
+
+	for (int i = 0; i < dict->nentries; i++)
+	{
+		fputc((dict->entries[i].parent >> 8) & 0xff, file);
+		fputc(dict->entries[i].parent & 0xff, file);
+		fputc(dict->entries[i].ch, file);
+	}
+}
+
+/*
+ * Loads a shared dictionary from a file.
+ */
+struct shdict *shdict_load(const char *filename)
+{
+	FILE *file;          /* Dictionary file. */
+	struct shdict *dict; /* Dictionary.      */
+
+	file = fopen(filename, "rb");
+	if (file == NULL)
+		error("cannot open dictionary file");
+
+	dict = shdict_read(file);
+
+	fclose(file);
+
+	return (dict);
+}
+
+/*
+ * Saves a shared dictionary to a file.
+ */
+void shdict_save(struct shdict *dict, const char *filename)
+{
+	FILE *file;
+
+	/* Sanity check. */
+	assert(dict != NULL);
+
+	file = fopen(filename, "wb");
+	if (file == NULL)
+		error("cannot open dictionary file");
+
+	shdict_write(dict, file);
+
+	if (fclose(file) != 0)
+		error("cannot write dictionary file");
+}
+
+/*============================================================================*
+ *                                  Training                                  *
+ *============================================================================*/
+
+/*
+ * Training candidate.
+ */
+struct shdict_candidate
+{
+	unsigned hits; /* Traversals of the node. */
+	int depth;     /* Depth of the node.      */
+	int node;      /* Trie node.              */
+};
+
+/*
+ * Ranks trie nodes, most traversed first, parents before children.
+ */
+static int shdict_cmp(const void *a, const void *b)
+{
+	const struct shdict_candidate *x = a;
+	const struct shdict_candidate *y = b;
+
+	if (x->hits != y->hits)
+		return ((x->hits < y->hits) ? 1 : -1);
+
+	if (x->depth != y->depth)
+		return (x->depth - y->depth);
+
+	return (x->node - y->node);
+}
+
+/*
+ * Trains a shared dictionary on a sample corpus.
+ *
+ * The corpus is parsed as LZW would parse it with an unbounded
+ * dictionary, and the phrases that were traversed the most are
+ * kept. Since a phrase is never traversed more often than its
+ * prefix, the selected set is prefix-closed.
+ */
+struct shdict *shdict_train(FILE *corpus, int radix, int max_entries)
+{
+	int ch;                         /* Working character.   */
+	int i, ni;                      /* Working nodes.       */
+	int *rank;                      /* Node to entry map.   */
+	int *depth;                     /* Depth of trie nodes. */
+	unsigned *hits;                 /* Traversals per node. */
+	int ncandidates;                /* Candidate count.     */
+	struct dictionary *trie;        /* Parsed phrases.      */
+	struct shdict_candidate *nodes; /* Candidate nodes.     */
+	struct shdict *dict;            /* Trained dictionary.  */
+
+	/* Sanity check. */
+	assert(corpus != NULL);
+	assert(radix == SHDICT_RADIX);
+	assert(max_entries > 0);
+
+	trie = dictionary_create(SHDICT_NODES, NULL);
+	hits = calloc(trie->max_entries, sizeof(unsigned));
+	depth = smalloc(trie->max_entries*sizeof(int));
+	if (hits == NULL)
+		error("cannot calloc()");
+
+	for (i = 0; i < radix; i++)
+		depth[dictionary_add(trie, 0, i, i)] = 1;
+
+	/* Parse corpus. */
+	i = 0;
+	while ((ch = fgetc(corpus)) != EOF)
+	{
+		ni = dictionary_find(trie, i, (char)ch);
+
+		/* Find longest prefix. */
+		if (ni >= 0)
+		{
+			hits[ni]++;
+			i = ni;
+			continue;
+		}
+
+		if (trie->nentries < trie->max_entries)
+			depth[dictionary_add(trie, i, ch, 0)] = depth[i] + 1;
+
+		i = dictionary_find(trie, 0, (char)ch);
+		hits[i]++;
+	}
+
+	/* Collect phrases that were used more than once. */
+	nodes = smalloc(trie->nentries*sizeof(struct shdict_candidate));
+	ncandidates = 0;
+	for (i = radix + 1; i < trie->nentries; i++)
+	{
+		if (hits[i] > 1)
+		{
+			nodes[ncandidates].hits = hits[i];
+			nodes[ncandidates].depth = depth[i];
+			nodes[ncandidates].node = i;
+			ncandidates++;
+		}
+	}
+
+	qsort(nodes, ncandidates, sizeof(struct shdict_candidate), shdict_cmp);
+
+	/* Build dictionary. */
+	rank = smalloc(trie->nentries*sizeof(int));
+	for (i = 0; i < trie->nentries; i++)
+		rank[i] = -1;
+
+	dict = smalloc(sizeof(struct shdict));
+	dict->entries = smalloc((max_entries + 1)*sizeof(struct shdict_entry));
+	dict->nentries = 0;
+	for (int k = 0; k < ncandidates; k++)
+	{
+		int p;
+
+		if (dict->nentries == max_entries)
+			break;
+
+		i = nodes[k].node;
+		p = trie->entries[i].parent;
+
+		/* Literal parent. */
+		if (depth[p] == 1)
+			dict->entries[dict->nentries].parent = (unsigned char)trie->entries[p].ch;
+
+		/* Trained parent. */
+		else if (rank[p] >= 0)
+			dict->entries[dict->nentries].parent = radix + rank[p];
+
+		/* Parent not selected. */
+		else
+			continue;
+
+		dict->entries[dict->nentries].ch = trie->entries[i].ch;
+		rank[i] = dict->nentries++;
+	}
+
+	dict->id = shdict_hash(dict);
+
+	/* House keeping. */
+	free(rank);
+	free(nodes);
+	free(depth);
+	free(hits);
+	dictionary_destroy(trie);
+
+	return (dict);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright(C) 2014-2016 Pedro H. Penna <pedrohenriquepenna@gmail.com>
+ *
+ * This file is part of compress.
+ *
+ * compress is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * compress is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with compress. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dictionary.h>
+#include <shdict.h>
+#include <stream.h>
+#include <strtab.h>
+
+/*
+ * Initializes the string table.
+ */
+unsigned strtab_init(struct strtab *st, int radix, code_t first, shdict_t shdict)
+{
+	unsigned i;
+
+	for (i = 0; i < (unsigned)radix; i++)
+	{
+		st->parent[i] = -1;
+		st->ch[i] = i;
+	}
+
+	/* Control codes. */
+	for ( ; i < first; i++)
+	{
+		st->parent[i] = -1;
+		st->ch[i] = ' ';
+	}
+
+	if (shdict == NULL)
+		return (i);
+
+	/* Prime with shared dictionary. */
+	for (int k = 0; k < shdict->nentries; k++)
+	{
+		unsigned p = shdict->entries[k].parent;
+
+		st->parent[i] = (p < (unsigned)radix) ? p : first + (p - radix);
+		st->ch[i++] = shdict->entries[k].ch;
+	}
+
+	return (i);
+}
+
+/*
+ * Expands a code into the string table buffer.
+ * Returns the index of the first character.
+ */
+unsigned strtab_expand(struct strtab *st, unsigned code)
+{
+	unsigned j = (1 << WIDTH);
+
+	for (int c = code; c >= 0; c = st->parent[c])
+		st->buf[--j] = st->ch[c];
+
+	return (j);
+}